@@ -0,0 +1,37 @@
+#!/bin/bash
+#
+# Benchmark the plotting pipeline for several sizes of the network:
+# writes a synthetic log and fibre map with FibreLogGenerator for each
+# size, and runs BenchFibrePipeline.C on them. The results of all runs
+# are appended to BenchFibrePipeline.jsonl (one line of JSON per run).
+#
+# Use:
+#
+#  ./BenchFibrePipeline.sh [label] [size ...]
+#
+# Each size is switches x ports x months, e.g. 3x3x1 (default sizes:
+# 3x3x1 10x8x1 10x8x6 30x8x3). Set LEGACY_MAP=1 to also time the old
+# mapping (very slow for the big ones).
+#
+# Needs FibreLogGenerator (g++ -O2 -o FibreLogGenerator FibreLogGenerator.cxx)
+# and ROOT.
+#
+
+label=${1:-$(date +%Y%m%d)}
+shift
+sizes=${@:-"3x3x1 10x8x1 10x8x6 30x8x3"}
+legacy=${LEGACY_MAP:-0}
+workdir=BenchFibrePipeline.d
+
+mkdir -p $workdir
+for size in $sizes
+do
+	IFS=x read switches ports months <<< "$size"
+	log=$workdir/MergedLog_$size.txt
+	map=$workdir/fibremap_$size.txt
+	if [ ! -f $log ]
+	then
+		./FibreLogGenerator -w $switches -p $ports -m $months -o $log -f $map || exit 1
+	fi
+	root -b -q "BenchFibrePipeline.C(\"$log\", \"$map\", \"BenchFibrePipeline.jsonl\", \"$label $size\", $legacy)"
+done
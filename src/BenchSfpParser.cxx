@@ -0,0 +1,301 @@
+/*
+ * BenchSfpParser
+ *
+ * Use:
+ *
+ *  - BenchSfpParser [-n repeats] [-p prompt] [-c script] <corpus file> [<corpus file> ...]
+ *
+ * Checks and times SfpParser.h on a corpus of "port sfp" answers: files
+ * in the format of conf/port_sfp_capture.txt (answers separated by "%%"
+ * lines), or the raw answers saved by FibreMonitorSwitches.sh and
+ * SwitchPoller when a read-out failed (one answer per file). Lines get
+ * the \r\n of the switch back, and each answer is fed in chunks of 4 kB,
+ * as it comes from the session.
+ *
+ *  -n repeats   Times each answer is parsed for the timing. Default: 10000.
+ *  -p prompt    Prompt line given before each answer, for the hostname.
+ *               Default: "BISMONITORSW1:/>".
+ *  -c script    Run every answer through script (e.g. ./ProcessData.sh,
+ *               which needs gawk) and compare its output with the parser,
+ *               instead of the .expected file. The time for the script is
+ *               printed too.
+ *
+ * By default, the answers of a corpus file are compared with the output
+ * of ProcessData.sh saved next to it: conf/port_sfp_capture.expected for
+ * conf/port_sfp_capture.txt (the ".txt" replaced by ".expected"), one
+ * output per answer, separated by "%%" lines. The comparison is: same
+ * lines (but for the date and time columns) and same number of "Error".
+ * Corpus files without one are only timed.
+ *
+ * Exits with 1 if any answer gives a different result.
+ *
+ * Compile with:
+ *
+ *  g++ -O2 -o BenchSfpParser BenchSfpParser.cxx
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "SfpParser.h"
+
+#define MAX_ANSWERS 10000
+#define CHUNK 4096
+
+static double seconds() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+/*
+ * Add the answers in filename to the corpus. Returns the number added.
+ */
+static int loadCorpus(const char *filename, char **answers, int *lengths, int nanswers) {
+  FILE *f = fopen(filename, "r");
+  if (f == NULL) {
+    fprintf(stderr, "Cannot read %s\n", filename);
+    return 0;
+  }
+  int added = 0, len = 0;
+  char *answer = (char*)malloc(SFP_MAXRAW);
+  char line[SFP_MAXLINE];
+  while (1) {
+    int end = (fgets(line, sizeof(line), f) == NULL);
+    if (end || (strncmp(line, "%%", 2) == 0)) {
+      if ((len > 0) && (nanswers + added < MAX_ANSWERS)) {
+        answers[nanswers + added] = answer;
+        lengths[nanswers + added] = len;
+        added++;
+        answer = (char*)malloc(SFP_MAXRAW);
+      }
+      len = 0;
+      if (end) break;
+      continue;
+    }
+    if (line[0] == '#') {
+      continue;
+    }
+    line[strcspn(line, "\r\n")] = '\0';
+    if (len + (int)strlen(line) + 2 < SFP_MAXRAW) {
+      len += sprintf(answer + len, "%s\r\n", line);
+    }
+  }
+  free(answer);
+  fclose(f);
+
+  return added;
+}
+
+static void parseAnswer(SfpParser *p, const char *prompt, const char *answer, int len) {
+  startSfpAnswer(p, prompt);
+  for (int pos = 0; pos < len; pos += CHUNK) {
+    feedSfpParser(p, answer + pos, (len - pos < CHUNK) ? len - pos : CHUNK);
+  }
+  finishSfpAnswer(p);
+}
+
+/*
+ * Skip the first (date) and third (date and time) columns of a log line.
+ */
+static void stripDates(const char *line, char *out, int outlen) {
+  const char *host = strchr(line, '\t');
+  const char *date = host ? strchr(host + 1, '\t') : NULL;
+  const char *values = date ? strchr(date + 1, '\t') : NULL;
+  if (values == NULL) {
+    snprintf(out, outlen, "%s", line);
+    return;
+  }
+  snprintf(out, outlen, "%.*s%s", (int)(date - host), host, values);
+}
+
+/*
+ * Compare the output of ProcessData.sh for one answer, read from out up to
+ * its end or a "%%" line, with the parser. Returns 1 if the same.
+ */
+static int compareOutput(FILE *out, SfpParser *p, int index, const char *source) {
+  char line[SFP_MAXLINE], expected[SFP_MAXLINE], got[SFP_MAXLINE];
+  int nlines = 0, nerrors = 0, same = 1;
+  time_t now = time(NULL);
+  while (fgets(line, sizeof(line), out) != NULL) {
+    if (strncmp(line, "%%", 2) == 0) {
+      break;
+    }
+    if (line[0] == '#') {
+      continue;
+    }
+    if (strstr(line, "Error") != NULL) {
+      nerrors++;
+      continue;
+    }
+    if (line[0] == '\n') {
+      continue;
+    }
+    if (nlines < p->nrecords) {
+      stripDates(line, expected, sizeof(expected));
+      formatSfpRecord(&p->records[nlines], now, line, sizeof(line));
+      stripDates(line, got, sizeof(got));
+      if (strcmp(expected, got) != 0) {
+        printf("Answer %d, line %d: %s gives %s           parser gives %s", index, nlines + 1, source, expected, got);
+        same = 0;
+      }
+    }
+    nlines++;
+  }
+
+  if ((nlines != p->nrecords) || (nerrors != p->nerrors)) {
+    printf("Answer %d: %s gives %d lines and %d Error, parser gives %d and %d\n", index, source, nlines, nerrors,
+           p->nrecords, p->nerrors);
+    same = 0;
+  }
+
+  return same;
+}
+
+/*
+ * Run one answer through the script and compare. Returns 1 if the same.
+ */
+static int compareScript(const char *script, const char *prompt, const char *answer, int len, SfpParser *p, int index) {
+  char tmpname[] = "/tmp/BenchSfpParserXXXXXX";
+  int fd = mkstemp(tmpname);
+  if (fd < 0) {
+    return 0;
+  }
+  FILE *tmp = fdopen(fd, "w");
+  fprintf(tmp, "%s\n", prompt);
+  for (int i = 0; i < len; i++) {
+    if (answer[i] != '\r') fputc(answer[i], tmp);
+  }
+  fclose(tmp);
+
+  char cmd[1000];
+  snprintf(cmd, sizeof(cmd), "%s %s", script, tmpname);
+  FILE *out = popen(cmd, "r");
+  if (out == NULL) {
+    unlink(tmpname);
+    return 0;
+  }
+  int same = compareOutput(out, p, index, "script");
+  pclose(out);
+  unlink(tmpname);
+
+  return same;
+}
+
+/*
+ * Open the .expected file of a corpus file, NULL if there is none.
+ */
+static FILE *openExpected(const char *filename) {
+  char name[1000];
+  int len = strlen(filename);
+  if ((len > 4) && (strcmp(filename + len - 4, ".txt") == 0)) {
+    len -= 4;
+  }
+  snprintf(name, sizeof(name), "%.*s.expected", len, filename);
+
+  return fopen(name, "r");
+}
+
+int main(int argc, char **argv) {
+  int repeats = 10000;
+  const char *prompt = "BISMONITORSW1:/>";
+  const char *script = NULL;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "n:p:c:")) != -1) {
+    switch (opt) {
+      case 'n': repeats = atoi(optarg); break;
+      case 'p': prompt = optarg; break;
+      case 'c': script = optarg; break;
+      default:
+        fprintf(stderr, "Use: %s [-n repeats] [-p prompt] [-c script] <corpus file> [<corpus file> ...]\n", argv[0]);
+        return 1;
+    }
+  }
+  if (optind >= argc) {
+    fprintf(stderr, "Use: %s [-n repeats] [-p prompt] [-c script] <corpus file> [<corpus file> ...]\n", argv[0]);
+    return 1;
+  }
+
+  char **answers = (char**)malloc(MAX_ANSWERS*sizeof(char*));
+  int *lengths = (int*)malloc(MAX_ANSWERS*sizeof(int));
+  int *answer_file = (int*)malloc(MAX_ANSWERS*sizeof(int));
+  FILE **expected = (FILE**)calloc(argc, sizeof(FILE*));
+  int nanswers = 0, nexpected = 0;
+  for (int f = optind; f < argc; f++) {
+    int added = loadCorpus(argv[f], answers, lengths, nanswers);
+    for (int a = nanswers; a < nanswers + added; a++) {
+      answer_file[a] = f;
+    }
+    nanswers += added;
+    if ((script == NULL) && (added > 0) && ((expected[f] = openExpected(argv[f])) != NULL)) {
+      nexpected++;
+    }
+  }
+  if (nanswers == 0) {
+    fprintf(stderr, "No answers in the corpus\n");
+    return 1;
+  }
+
+  SfpParser parser;
+  initSfpParser(&parser);
+  int status = 0;
+
+  // Results, and comparison with the script
+  double script_time = 0;
+  for (int a = 0; a < nanswers; a++) {
+    parseAnswer(&parser, prompt, answers[a], lengths[a]);
+    printf("Answer %d: %s, %d ports, %d with negative values\n", a, parser.nrecords > 0 ? parser.records[0].hostname : "?",
+           parser.nrecords, parser.nerrors);
+    if (script != NULL) {
+      double t = seconds();
+      if (!compareScript(script, prompt, answers[a], lengths[a], &parser, a)) {
+        status = 1;
+      }
+      script_time += seconds() - t;
+    }
+    else if ((expected[answer_file[a]] != NULL) && !compareOutput(expected[answer_file[a]], &parser, a, "expected")) {
+      status = 1;
+    }
+  }
+
+  // Timing
+  long bytes = 0, records = 0;
+  double t = seconds();
+  for (int r = 0; r < repeats; r++) {
+    for (int a = 0; a < nanswers; a++) {
+      parseAnswer(&parser, prompt, answers[a], lengths[a]);
+      bytes += lengths[a];
+      records += parser.nrecords;
+    }
+  }
+  double parser_time = seconds() - t;
+
+  printf("Parser: %ld answers in %.3f s, %.1f MB/s, %.0f answers/s, %.2f us per answer (%ld records)\n",
+         (long)repeats*nanswers, parser_time, bytes/parser_time/1e6, repeats*nanswers/parser_time,
+         parser_time*1e6/(repeats*nanswers), records);
+  if (script != NULL) {
+    printf("Script: %d answers in %.3f s, %.2f ms per answer (%.0f times slower)\n", nanswers, script_time,
+           script_time*1e3/nanswers, (script_time/nanswers)/(parser_time/(repeats*nanswers)));
+  }
+  if ((script != NULL) || (nexpected > 0)) {
+    printf("%s\n", status ? "DIFFERENT results" : "Same results");
+  }
+
+  for (int a = 0; a < nanswers; a++) {
+    free(answers[a]);
+  }
+  for (int f = optind; f < argc; f++) {
+    if (expected[f] != NULL) fclose(expected[f]);
+  }
+  free(answers);
+  free(lengths);
+  free(answer_file);
+  free(expected);
+  freeSfpParser(&parser);
+
+  return status;
+}
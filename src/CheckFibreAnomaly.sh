@@ -0,0 +1,49 @@
+#!/bin/bash
+#
+# Check that the detector of FibreAnomaly.h raises a STEP alert for every
+# step of the smallest size it is meant to catch (step_db, 0.3 dB): a
+# synthetic log is written with FibreLogGenerator for each seed, and
+# FibreAnomalyReplay adds a step up and, later, a step down of 0.3 dB to
+# every fibre. Fails (exit 1) if any step was missed.
+#
+# Use:
+#
+#  ./CheckFibreAnomaly.sh [seeds] [size]
+#
+# size is switches x ports x months as in BenchFibrePipeline.sh. Default:
+# 10 seeds of 4x5x1 (800 steps).
+#
+# Needs FibreLogGenerator and FibreAnomalyReplay.
+#
+
+seeds=${1:-10}
+size=${2:-4x5x1}
+db=0.3
+workdir=CheckFibreAnomaly.d
+
+IFS=x read switches ports months <<< "$size"
+nfibres=$(( $switches * $ports ))
+hours=$(( $months * 30 * 24 ))
+
+mkdir -p $workdir
+failed=0
+for((seed=1;seed<=$seeds;seed++)) do
+	log=$workdir/MergedLog_$seed.txt
+	map=$workdir/fibremap_$seed.txt
+	./FibreLogGenerator -w $switches -p $ports -m $months -s $seed -o $log -f $map > /dev/null || exit 1
+	# Steps spread over the log, after the warm-up, and apart from each other
+	steps=""
+	for((f=1;f<=$nfibres;f++)) do
+		up=$(( $hours/8 + ($f * 37) % ($hours/3) ))
+		down=$(( $hours/2 + ($f * 53) % ($hours/3) ))
+		steps="$steps -s $f,$up.3,$db -s $f,$down.6,-$db"
+	done
+	if ! ./FibreAnomalyReplay -o $workdir/alerts_$seed.txt $steps $map $log > $workdir/steps_$seed.txt
+	then
+		grep MISSED $workdir/steps_$seed.txt
+		failed=1
+	fi
+	echo "seed $seed: $(tail -n 1 $workdir/steps_$seed.txt)"
+done
+
+exit $failed
@@ -0,0 +1,108 @@
+#!/bin/bash
+#
+# Compare the plotting after each cycle done the old way (cron starts
+# "root -b -q PlotFibreMonSwitch.C(-1)") with FibreMonitorDaemon, on a
+# synthetic log written by FibreLogGenerator:
+#
+#  - startup: the macro on the whole log with no checkpoint, and the
+#    daemon from its start until it answers (fibre map, end of the log
+#    and all the plots),
+#  - cycle: a cycle of lines appended to the log, then the macro again
+#    (ROOT is started and the macro compiled every time), or SYNC to the
+#    daemon with FibreMonitorClient. The CPU of a daemon cycle is that of
+#    the daemon (from STATUS before and after) plus the user and system
+#    time of the client.
+#
+# Prints the real and CPU seconds (means for the cycles) and appends them
+# as a line of JSON to CompareFibreMonitorDaemon.jsonl.
+#
+# Use:
+#
+#  ./CompareFibreMonitorDaemon.sh [cycles] [size]
+#
+# size is switches x ports x months as in BenchFibrePipeline.sh. Default:
+# 6 cycles of 3x3x1.
+#
+# Needs FibreLogGenerator, FibreMonitorDaemon, FibreMonitorClient and ROOT.
+#
+
+cycles=${1:-6}
+size=${2:-3x3x1}
+here=$(pwd)
+workdir=CompareFibreMonitorDaemon.d
+
+IFS=x read switches ports months <<< "$size"
+rows=$(( $switches * $ports ))	# Lines per cycle: no gaps or retries
+
+mkdir -p $workdir
+cd $workdir
+$here/FibreLogGenerator -w $switches -p $ports -m $months -g 0 -d 0 -e 0 -o full.txt -f fibremap.txt > /dev/null || exit 1
+total=$(wc -l < full.txt)
+keep=$(( $total - $cycles * $rows ))
+rm -f times.txt
+
+# Real, user and system seconds of a command
+TIMEFORMAT="%R %U %S"
+timed() {
+	{ time "$@" > /dev/null 2>&1 ; } 2>&1
+}
+
+appendCycle() {
+	tail -n +$(( $keep + $1 * $rows + 1 )) full.txt | head -n $rows >> MergedLog.txt
+}
+
+daemonCpu() {
+	$here/FibreMonitorClient -S daemon.sock STATUS | sed 's/.*cpu_s=\([0-9.]*\).*/\1/'
+}
+
+# Cron and macro
+rm -f MergedLog.txt* *.png
+head -n $keep full.txt > MergedLog.txt
+read real user sys <<< "$(timed root -b -q "$here/PlotFibreMonSwitch.C(-1)")"
+echo "cron startup $real $user $sys" >> times.txt
+for((c=0;c<$cycles;c++)) do
+	appendCycle $c
+	read real user sys <<< "$(timed root -b -q "$here/PlotFibreMonSwitch.C(-1)")"
+	echo "cron cycle $real $user $sys" >> times.txt
+done
+
+# Daemon: it only reads the log when told to (SYNC)
+rm -f MergedLog.txt* *.png
+head -n $keep full.txt > MergedLog.txt
+start=$(date +%s.%N)
+$here/FibreMonitorDaemon -S daemon.sock -d $(( $months * 30 )) -f 86400 -q 86400 > daemon.log 2>&1 &
+pid=$!
+until $here/FibreMonitorClient -S daemon.sock STATUS > /dev/null 2>&1
+do
+	if ! kill -0 $pid 2> /dev/null
+	then
+		cat daemon.log
+		exit 1
+	fi
+	sleep 0.05
+done
+end=$(date +%s.%N)
+echo "daemon startup $(awk "BEGIN {print $end - $start}") $(daemonCpu) 0" >> times.txt
+for((c=0;c<$cycles;c++)) do
+	appendCycle $c
+	before=$(daemonCpu)
+	read real user sys <<< "$(timed $here/FibreMonitorClient -S daemon.sock SYNC)"
+	echo "daemon cycle $real $(awk "BEGIN {print $(daemonCpu) - $before}") $(awk "BEGIN {print $user + $sys}")" >> times.txt
+done
+kill $pid
+wait $pid
+
+# Report
+awk -v size=$size -v cycles=$cycles -v date=$(date +%Y-%m-%dT%H:%M:%S) '
+	{ key = $1 "_" $2; n[key]++; real[key] += $3; cpu[key] += $4 + $5 }
+	END {
+		printf("%s, %d cycles        real_s     cpu_s\n", size, cycles)
+		split("cron_startup cron_cycle daemon_startup daemon_cycle", keys, " ")
+		json = sprintf("{\"date\": \"%s\", \"size\": \"%s\", \"cycles\": %d", date, size, cycles)
+		for (i = 1; i <= 4; i++) {
+			k = keys[i]
+			printf("  %-22s %9.3f %9.3f\n", k, real[k]/n[k], cpu[k]/n[k])
+			json = json sprintf(", \"%s\": {\"real_s\": %.4f, \"cpu_s\": %.4f}", k, real[k]/n[k], cpu[k]/n[k])
+		}
+		print json "}" >> "../CompareFibreMonitorDaemon.jsonl"
+	}' times.txt
@@ -0,0 +1,127 @@
+/*
+ * FakeSwitchCLI
+ *
+ * Use:
+ *
+ *  - FakeSwitchCLI [-n hostname] [-d delay_ms] [-x exit_after] <capture file>
+ *
+ * Pretends to be the CLI of an MGSD-10080F on stdin/stdout, to try
+ * SwitchPoller (or switchread.sh) without the switches:
+ *
+ *  - asks for a password and then shows the "<HOSTNAME>:/>" prompt,
+ *  - answers "port sfp" with the next answer of the capture file
+ *    (see conf/port_sfp_capture.txt), in a loop, after delay_ms,
+ *  - exits on "logout", or after exit_after commands to simulate a
+ *    dropped session.
+ *
+ * For instance:
+ *
+ *  SWITCH_PASSWORD=any SwitchPoller -c "./FakeSwitchCLI -n BISMONITORSW%s ../conf/port_sfp_capture.txt" 1 2 3
+ *
+ * Compile with:
+ *
+ *  g++ -O2 -o FakeSwitchCLI FakeSwitchCLI.cxx
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define MAX_ANSWERS 100
+#define MAX_ANSWER_LEN 100000
+
+int main(int argc, char **argv) {
+  const char *hostname = "SWITCH";
+  int delay_ms = 0;
+  int exit_after = -1;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "n:d:x:")) != -1) {
+    switch (opt) {
+      case 'n': hostname = optarg; break;
+      case 'd': delay_ms = atoi(optarg); break;
+      case 'x': exit_after = atoi(optarg); break;
+      default:
+        fprintf(stderr, "Use: %s [-n hostname] [-d delay_ms] [-x exit_after] <capture file>\n", argv[0]);
+        return 1;
+    }
+  }
+  if (optind >= argc) {
+    fprintf(stderr, "Use: %s [-n hostname] [-d delay_ms] [-x exit_after] <capture file>\n", argv[0]);
+    return 1;
+  }
+
+  // Load the answers
+  FILE *f = fopen(argv[optind], "r");
+  if (f == NULL) {
+    fprintf(stderr, "Cannot read %s\n", argv[optind]);
+    return 1;
+  }
+  char *answers[MAX_ANSWERS];
+  int nanswers = 0;
+  int len = 0;
+  char line[1000];
+  answers[0] = (char*)calloc(MAX_ANSWER_LEN, 1);
+  while (fgets(line, sizeof(line), f) != NULL) {
+    if (line[0] == '#') {
+      continue;
+    }
+    if (strncmp(line, "%%", 2) == 0) {
+      if ((len > 0) && (nanswers < MAX_ANSWERS - 1)) {
+        nanswers++;
+        answers[nanswers] = (char*)calloc(MAX_ANSWER_LEN, 1);
+        len = 0;
+      }
+      continue;
+    }
+    int l = strlen(line);
+    if (len + l + 2 < MAX_ANSWER_LEN) {
+      // The switch ends lines with \r\n
+      if ((l > 0) && (line[l - 1] == '\n')) {
+        line[--l] = '\0';
+      }
+      len += sprintf(answers[nanswers] + len, "%s\r\n", line);
+    }
+  }
+  fclose(f);
+  if (len > 0) {
+    nanswers++;
+  }
+  if (nanswers == 0) {
+    fprintf(stderr, "No answers in %s\n", argv[optind]);
+    return 1;
+  }
+
+  setvbuf(stdout, NULL, _IONBF, 0);
+  printf("Password: ");
+  if (fgets(line, sizeof(line), stdin) == NULL) {
+    return 0;
+  }
+  printf("\r\nWelcome to the MGSD-10080F command line interface\r\n\r\n%s:/> ", hostname);
+
+  int next = 0;
+  int commands = 0;
+  while (fgets(line, sizeof(line), stdin) != NULL) {
+    line[strcspn(line, "\r\n")] = '\0';
+    if (strcmp(line, "logout") == 0) {
+      printf("\r\nBye\r\n");
+      return 0;
+    }
+    if (strcmp(line, "port sfp") == 0) {
+      if (delay_ms > 0) {
+        usleep(delay_ms*1000);
+      }
+      printf("\r\n%s", answers[next]);
+      next = (next + 1)%nanswers;
+    }
+    else if (line[0] != '\0') {
+      printf("\r\nUnknown command: %s\r\n", line);
+    }
+    printf("\r\n%s:/> ", hostname);
+    if ((exit_after > 0) && (++commands >= exit_after)) {
+      return 0;
+    }
+  }
+
+  return 0;
+}
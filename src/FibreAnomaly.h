@@ -0,0 +1,457 @@
+/*
+ * FibreAnomaly.h
+ *
+ * Finds fibres going bad as the read-outs come in, instead of someone
+ * looking at attenuation.png. For every fibre of the fibre map, with a
+ * few numbers of state and no history:
+ *
+ *  - the attenuation (Ptx - Prx - attenuator) of each poll cycle in which
+ *    both ends were read,
+ *  - a baseline: exponentially weighted mean and variance of the
+ *    attenuation (the first "warmup" samples are averaged evenly),
+ *  - a two-sided CUSUM of the deviations from the baseline, in sigmas.
+ *    When it goes over h, the new level is the mean of that sample and
+ *    the next ones, up to "confirm" of them. A STEP alert is raised as soon as the change is
+ *    at least step_db by more than 3 standard errors (a big jump does it
+ *    in one sample), and otherwise after "confirm" samples unless it is
+ *    below step_db by more than 3 standard errors. So a change of step_db
+ *    is not taken into the baseline without an alert because of the noise
+ *    of a sample or two; a smaller one may get an alert on a noisy fibre,
+ *  - the baseline is compared with a reference (the baseline after the
+ *    warm-up or the last DRIFT alert, moved by the STEP alerts): a DRIFT
+ *    alert when they are more than drift_db apart. Samples more than
+ *    3 sigmas away don't move the baseline, so steps don't look like drift,
+ *  - at the end of each cycle, even if no switch answered, the fibres
+ *    with an end not read in it get a STALE alert (MISSING if never
+ *    read), and a BACK alert when they come back.
+ *
+ * Samples are the rows of the log: hostname:port, time (as in
+ * FibreLogReader.h), Ptx and Prx. The rows of a cycle may have slightly
+ * different times: a row more than half an interval after the first of
+ * the cycle starts a new one. Rows of cycles already done are ignored.
+ *
+ * Alerts go to a log file, a line each:
+ *
+ *   2014.07.01 10:20 <tab> SR7toUA67 <tab> STEP <tab> +3.20 <tab> att=13.52 baseline=10.32 sigma=0.05
+ *
+ * and the alerts of the last cycle are also in alerts[]. The state can be
+ * saved and loaded, for programs that run once per cycle.
+ */
+#ifndef FIBREANOMALY_H
+#define FIBREANOMALY_H
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "FibreLogReader.h"
+#include "FibreMap.h"
+
+#define FIBREANOMALY_MAGIC "FIBREANO"
+#define FIBREANOMALY_VERSION 2
+#define FIBREANOMALY_TX 1
+#define FIBREANOMALY_RX 2
+
+enum {
+  FIBREANOMALY_STEP,
+  FIBREANOMALY_DRIFT,
+  FIBREANOMALY_STALE,
+  FIBREANOMALY_MISSING,
+  FIBREANOMALY_BACK
+};
+
+static const char *fibreAnomalyKind[] = {"STEP", "DRIFT", "STALE", "MISSING", "BACK"};
+
+typedef struct {
+  int interval;                 // Seconds between poll cycles
+  float alpha;                  // Weight of a new sample in the baseline
+  float k;                      // CUSUM allowance, in sigmas
+  float h;                      // CUSUM threshold, in sigmas
+  float sigma_min;              // Noise floor, dB
+  float step_db;                // Smallest step worth an alert, dB
+  float drift_db;               // Drift threshold, dB
+  int warmup;                   // Samples before any STEP or DRIFT alert
+  int confirm;                  // Samples to measure the new level of a change
+} FibreAnomalyConfig;
+
+/*
+ * State of one fibre. Constant size, saved as is.
+ */
+typedef struct {
+  int tx_time;                  // Last read-out of each end, 0 if never
+  int rx_time;
+  float Ptx;
+  float Prx;
+  int fresh;                    // Ends read in this cycle (FIBREANOMALY_TX | FIBREANOMALY_RX)
+  int stale;                    // Ends reported as stale or missing
+  int n;                        // Samples in the baseline
+  float mean;                   // Baseline of the attenuation
+  float var;
+  float reference;              // Baseline to measure the drift from
+  float cusum_up;
+  float cusum_down;
+  int n_up;                     // Samples since each CUSUM was 0
+  int n_down;
+  int n_change;                 // Samples of a change being measured, 0 if none
+  float sum_change;             // Sum of their deviations from the baseline
+  float sigma_change;           // Sigma when the change was found
+} FibreAnomalyFibre;
+
+typedef struct {
+  int time;
+  int fibre;
+  int kind;
+  float value;                  // dB for STEP and DRIFT, minutes since read for STALE
+  char detail[100];
+} FibreAnomalyAlert;
+
+/*
+ * Where each hostname:port goes, found in the fibre map only once.
+ */
+typedef struct {
+  char hostname[FIBRELOG_HOSTLEN];
+  int port;
+  int tx;
+  int rx;
+} FibreAnomalyEndpoint;
+
+typedef struct {
+  FibreAnomalyConfig config;
+  int nfibres;
+  const FibreMapEntry *map;
+  unsigned int map_hash;
+  FibreAnomalyFibre *fibres;
+
+  int start_time;               // First cycle seen
+  int cycle_time;               // Cycle being filled, 0 if none
+  int last_cycle;               // Last cycle done
+
+  FibreAnomalyEndpoint *endpoints;   // Open addressing, hostname[0] == 0 if free
+  int endpoints_size;
+  int nendpoints;
+
+  FILE *log;
+  FibreAnomalyAlert *alerts;    // Of the last cycle
+  int nalerts;
+  int alerts_capacity;
+  long total_alerts;
+} FibreAnomaly;
+
+static void defaultFibreAnomalyConfig(FibreAnomalyConfig *config) {
+  config->interval = 600;
+  config->alpha = 0.05;
+  config->k = 0.5;
+  config->h = 5;
+  config->sigma_min = 0.05;
+  config->step_db = 0.3;
+  config->drift_db = 1.0;
+  config->warmup = 6;
+  config->confirm = 4;
+}
+
+/*
+ * Start with no history. The fibre map must stay around. Alerts are
+ * written to log, if not NULL.
+ */
+static void initFibreAnomaly(FibreAnomaly *det, const FibreAnomalyConfig *config, const FibreMapEntry *map,
+                             int nfibres, FILE *log) {
+  memset(det, 0, sizeof(FibreAnomaly));
+  det->config = *config;
+  det->nfibres = nfibres;
+  det->map = map;
+  det->map_hash = fibreMapHash(map, nfibres);
+  det->fibres = (FibreAnomalyFibre*)calloc(nfibres, sizeof(FibreAnomalyFibre));
+  det->endpoints_size = 64;
+  while (det->endpoints_size < 4*nfibres) det->endpoints_size *= 2;
+  det->endpoints = (FibreAnomalyEndpoint*)calloc(det->endpoints_size, sizeof(FibreAnomalyEndpoint));
+  det->log = log;
+}
+
+static void freeFibreAnomaly(FibreAnomaly *det) {
+  free(det->fibres);
+  free(det->endpoints);
+  free(det->alerts);
+  memset(det, 0, sizeof(FibreAnomaly));
+}
+
+static FibreAnomalyEndpoint *fibreAnomalyEndpoint(FibreAnomaly *det, const char *hostname, int port) {
+  unsigned int hash = fibreCheckpointHash(hostname, strlen(hostname), 0);
+  hash = fibreCheckpointHash(&port, sizeof(port), hash);
+  int mask = det->endpoints_size - 1;
+  for (int i = hash & mask; ; i = (i + 1) & mask) {
+    FibreAnomalyEndpoint *e = &det->endpoints[i];
+    if (e->hostname[0] == '\0') {
+      break;
+    }
+    if ((e->port == port) && (strcmp(e->hostname, hostname) == 0)) {
+      return e;
+    }
+  }
+
+  // New one: keep the table at most half full
+  if (2*(det->nendpoints + 1) > det->endpoints_size) {
+    FibreAnomalyEndpoint *old = det->endpoints;
+    int old_size = det->endpoints_size;
+    det->endpoints_size *= 2;
+    det->endpoints = (FibreAnomalyEndpoint*)calloc(det->endpoints_size, sizeof(FibreAnomalyEndpoint));
+    mask = det->endpoints_size - 1;
+    for (int j = 0; j < old_size; j++) {
+      if (old[j].hostname[0] == '\0') continue;
+      unsigned int h = fibreCheckpointHash(old[j].hostname, strlen(old[j].hostname), 0);
+      h = fibreCheckpointHash(&old[j].port, sizeof(old[j].port), h);
+      int i = h & mask;
+      while (det->endpoints[i].hostname[0] != '\0') i = (i + 1) & mask;
+      det->endpoints[i] = old[j];
+    }
+    free(old);
+  }
+  int i = hash & mask;
+  while (det->endpoints[i].hostname[0] != '\0') i = (i + 1) & mask;
+  FibreAnomalyEndpoint *e = &det->endpoints[i];
+  snprintf(e->hostname, sizeof(e->hostname), "%s", hostname);
+  e->port = port;
+  fibreMapFind(det->map, det->nfibres, hostname, port, &e->tx, &e->rx);
+  det->nendpoints++;
+
+  return e;
+}
+
+static void fibreAnomalyAlert(FibreAnomaly *det, int time, int fibre, int kind, float value, const char *detail) {
+  if (det->nalerts == det->alerts_capacity) {
+    det->alerts_capacity = det->alerts_capacity ? 2*det->alerts_capacity : 16;
+    det->alerts = (FibreAnomalyAlert*)realloc(det->alerts, det->alerts_capacity*sizeof(FibreAnomalyAlert));
+  }
+  FibreAnomalyAlert *a = &det->alerts[det->nalerts++];
+  a->time = time;
+  a->fibre = fibre;
+  a->kind = kind;
+  a->value = value;
+  snprintf(a->detail, sizeof(a->detail), "%s", detail);
+  det->total_alerts++;
+
+  if (det->log != NULL) {
+    int year, month, day, hour, minute;
+    fibreLogCivil(time, &year, &month, &day, &hour, &minute);
+    fprintf(det->log, "%04d.%02d.%02d %02d:%02d\t%s\t%s\t%+.2f\t%s\n", year, month, day, hour, minute,
+            det->map[fibre].fibrename, fibreAnomalyKind[kind], value, detail);
+  }
+}
+
+/*
+ * New attenuation sample of fibre k.
+ */
+static void fibreAnomalyUpdate(FibreAnomaly *det, int k, int time, float att) {
+  const FibreAnomalyConfig *c = &det->config;
+  FibreAnomalyFibre *f = &det->fibres[k];
+  char detail[100];
+
+  f->n++;
+  if (f->n <= c->warmup) {     // Plain average to start with
+    float a = 1.0/f->n;
+    float d = att - f->mean;
+    f->mean += a*d;
+    f->var = (1 - a)*(f->var + a*d*d);
+    f->reference = f->mean;
+    return;
+  }
+
+  float sigma = sqrt(f->var);
+  if (sigma < c->sigma_min) sigma = c->sigma_min;
+  float d = att - f->mean;
+  float z = d/sigma;
+
+  f->cusum_up += z - c->k;
+  f->n_up++;
+  if (f->cusum_up <= 0) {
+    f->cusum_up = 0;
+    f->n_up = 0;
+  }
+  f->cusum_down += -z - c->k;
+  f->n_down++;
+  if (f->cusum_down <= 0) {
+    f->cusum_down = 0;
+    f->n_down = 0;
+  }
+  if ((f->n_change == 0) && ((f->cusum_up > c->h) || (f->cusum_down > c->h))) {
+    // A change, measured from this sample on: the samples before it, since
+    // the CUSUM started going up (or down), may be from before the change
+    f->n_change = 1;
+    f->sum_change = d;
+    f->sigma_change = sigma;
+  }
+  else if (f->n_change > 0) {
+    f->n_change++;
+    f->sum_change += d;
+  }
+  if (f->n_change > 0) {
+    float shift = f->sum_change/f->n_change;
+    float error = 3*f->sigma_change/sqrt(f->n_change);
+    int alert = (fabs(shift) - error >= c->step_db);
+    if (!alert && (f->n_change < c->confirm)) {
+      return;                   // Not sure yet: the baseline waits
+    }
+    if (alert || (fabs(shift) + error >= c->step_db)) {
+      snprintf(detail, sizeof(detail), "att=%.2f baseline=%.2f sigma=%.2f n=%d", att, f->mean, f->sigma_change,
+               f->n_change);
+      fibreAnomalyAlert(det, time, k, FIBREANOMALY_STEP, shift, detail);
+      f->reference += shift;
+    }
+    f->mean += shift;
+    f->cusum_up = 0;
+    f->cusum_down = 0;
+    f->n_up = 0;
+    f->n_down = 0;
+    f->n_change = 0;
+    f->sum_change = 0;
+    return;
+  }
+
+  if (fabs(z) < 3) {
+    f->mean += c->alpha*d;
+    f->var = (1 - c->alpha)*(f->var + c->alpha*d*d);
+  }
+  if (fabs(f->mean - f->reference) > c->drift_db) {
+    snprintf(detail, sizeof(detail), "baseline=%.2f reference=%.2f", f->mean, f->reference);
+    fibreAnomalyAlert(det, time, k, FIBREANOMALY_DRIFT, f->mean - f->reference, detail);
+    f->reference = f->mean;
+  }
+}
+
+/*
+ * Finish the current cycle: update the fibres read at both ends and look
+ * for stale ones. "now" is when the cycle ended (time as in
+ * FibreLogReader.h), or 0 if only the rows tell the time. A cycle with no
+ * rows at all (no switch answered) is still looked at for stale fibres,
+ * at "now".
+ */
+static void fibreAnomalyFlush(FibreAnomaly *det, int now) {
+  det->nalerts = 0;
+  int time = (det->cycle_time != 0) ? det->cycle_time : now;
+  if (time <= det->last_cycle) {
+    return;
+  }
+  if (det->start_time == 0) {
+    det->start_time = time;
+  }
+  int stale_s = det->config.interval/2;    // Not read in this cycle
+  char detail[100];
+
+  for (int k = 0; k < det->nfibres; k++) {
+    FibreAnomalyFibre *f = &det->fibres[k];
+    if (f->fresh == (FIBREANOMALY_TX | FIBREANOMALY_RX)) {
+      fibreAnomalyUpdate(det, k, time, f->Ptx - f->Prx - det->map[k].attenuator);
+    }
+    f->fresh = 0;
+
+    int stale = 0;
+    if ((f->tx_time == 0) || (time - f->tx_time > stale_s)) stale |= FIBREANOMALY_TX;
+    if ((f->rx_time == 0) || (time - f->rx_time > stale_s)) stale |= FIBREANOMALY_RX;
+    if ((stale != 0) && (time - det->start_time > stale_s) && ((stale & ~f->stale) != 0)) {
+      snprintf(detail, sizeof(detail), "%s", stale == FIBREANOMALY_TX ? "tx" : (stale == FIBREANOMALY_RX ? "rx" : "tx,rx"));
+      int never = ((stale & FIBREANOMALY_TX) && (f->tx_time == 0)) || ((stale & FIBREANOMALY_RX) && (f->rx_time == 0));
+      int last = (stale & FIBREANOMALY_TX) ? f->tx_time : f->rx_time;
+      if ((stale & FIBREANOMALY_RX) && (f->rx_time < last)) last = f->rx_time;
+      fibreAnomalyAlert(det, time, k, never ? FIBREANOMALY_MISSING : FIBREANOMALY_STALE,
+                        never ? 0 : (time - last)/60.0, detail);
+      f->stale |= stale;
+    }
+    else if ((stale == 0) && (f->stale != 0)) {
+      fibreAnomalyAlert(det, time, k, FIBREANOMALY_BACK, 0, "");
+      f->stale = 0;
+    }
+  }
+  if (det->log != NULL) {
+    fflush(det->log);
+  }
+  det->last_cycle = time;
+  det->cycle_time = 0;
+}
+
+/*
+ * A row of the log. Returns 1 if it belongs to a fibre.
+ */
+static int fibreAnomalySample(FibreAnomaly *det, const char *hostname, int port, int time, float Ptx, float Prx) {
+  if ((time <= det->last_cycle) || (hostname[0] == '\0')) {   // Cycle already done, or duplicate
+    return 0;
+  }
+  if ((det->cycle_time != 0) && (time > det->cycle_time + det->config.interval/2)) {
+    fibreAnomalyFlush(det, 0);
+  }
+  if (det->cycle_time == 0) {
+    det->cycle_time = time;
+    if (det->start_time == 0) {
+      det->start_time = time;
+    }
+  }
+
+  FibreAnomalyEndpoint *e = fibreAnomalyEndpoint(det, hostname, port);
+  if (e->tx >= 0) {
+    FibreAnomalyFibre *f = &det->fibres[e->tx];
+    f->Ptx = Ptx;
+    f->tx_time = time;
+    f->fresh |= FIBREANOMALY_TX;
+  }
+  if (e->rx >= 0) {
+    FibreAnomalyFibre *f = &det->fibres[e->rx];
+    f->Prx = Prx;
+    f->rx_time = time;
+    f->fresh |= FIBREANOMALY_RX;
+  }
+
+  return (e->tx >= 0) || (e->rx >= 0);
+}
+
+/*
+ * Save the state (after fibreAnomalyFlush()). Written to a temporary file
+ * and renamed. Returns 1 on success.
+ */
+static int saveFibreAnomaly(const char *filename, const FibreAnomaly *det) {
+  char tmpname[1000];
+  snprintf(tmpname, sizeof(tmpname), "%s.tmp", filename);
+  FILE *f = fopen(tmpname, "wb");
+  if (f == NULL) {
+    return 0;
+  }
+  int header[5] = {FIBREANOMALY_VERSION, det->nfibres, (int)det->map_hash, det->start_time, det->last_cycle};
+  int ok = (fwrite(FIBREANOMALY_MAGIC, 8, 1, f) == 1) && (fwrite(header, sizeof(header), 1, f) == 1) &&
+           (fwrite(det->fibres, sizeof(FibreAnomalyFibre), det->nfibres, f) == (size_t)det->nfibres);
+  ok = (fclose(f) == 0) && ok;
+  if (!ok || (rename(tmpname, filename) != 0)) {
+    unlink(tmpname);
+    return 0;
+  }
+
+  return 1;
+}
+
+/*
+ * Load the state saved for the same fibre map. Returns 1 if loaded, 0 if
+ * missing or for another map (the detector starts with no history).
+ */
+static int loadFibreAnomaly(const char *filename, FibreAnomaly *det) {
+  FILE *f = fopen(filename, "rb");
+  if (f == NULL) {
+    return 0;
+  }
+  char magic[8];
+  int header[5];
+  int ok = (fread(magic, 8, 1, f) == 1) && (memcmp(magic, FIBREANOMALY_MAGIC, 8) == 0) &&
+           (fread(header, sizeof(header), 1, f) == 1) && (header[0] == FIBREANOMALY_VERSION) &&
+           (header[1] == det->nfibres) && ((unsigned int)header[2] == det->map_hash);
+  FibreAnomalyFibre *fibres = (FibreAnomalyFibre*)calloc(det->nfibres, sizeof(FibreAnomalyFibre));
+  ok = ok && (fread(fibres, sizeof(FibreAnomalyFibre), det->nfibres, f) == (size_t)det->nfibres);
+  fclose(f);
+  if (ok) {
+    memcpy(det->fibres, fibres, det->nfibres*sizeof(FibreAnomalyFibre));
+    det->start_time = header[3];
+    det->last_cycle = header[4];
+    det->cycle_time = 0;
+  }
+  free(fibres);
+
+  return ok;
+}
+
+#endif
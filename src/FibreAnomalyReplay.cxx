@@ -0,0 +1,199 @@
+/*
+ * FibreAnomalyReplay
+ *
+ * Use:
+ *
+ *  - FibreAnomalyReplay [options] <fibre map> <log file> [<log file> ...]
+ *
+ * Runs the detector of FibreAnomaly.h over MergedLog.txt-style files, as
+ * if the rows were coming from the switches, and writes the alerts.
+ * Used to tune the detector on old logs, and to check it on synthetic
+ * ones with steps added on purpose:
+ *
+ *  -o file            Alert log. Default: standard output.
+ *  -i seconds         Poll interval. Default: 600.
+ *  -s fibre,hours,dB  Add dB to the attenuation of fibre (number in the
+ *                     fibre map) from "hours" after the start of the log
+ *                     on (by taking it from Prx). Can be repeated.
+ *  -k k -h h         CUSUM allowance and threshold, in sigmas.
+ *  -d dB -t dB        Drift threshold and smallest step for an alert.
+ *
+ * With -s, says for each added step whether a STEP alert came for it,
+ * and how many cycles later, and counts the STEP alerts that were not
+ * for an added step. Exits with 1 if a step was missed.
+ *
+ * Compile with:
+ *
+ *  g++ -O2 -o FibreAnomalyReplay FibreAnomalyReplay.cxx
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "FibreLogReader.h"
+#include "FibreMap.h"
+#include "FibreAnomaly.h"
+
+#define MAX_STEPS 100
+
+typedef struct {
+  int fibre;                    // Index in the map
+  int time;                     // Start
+  float db;
+  int detected;                 // Time of the STEP alert, 0 if none
+} Step;
+
+/*
+ * Match the STEP alerts of the cycle just finished with the added steps.
+ * Returns the number of STEP alerts that were not for one.
+ */
+static int matchSteps(const FibreAnomaly *det, Step *steps, int nsteps) {
+  int other = 0;
+  for (int a = 0; a < det->nalerts; a++) {
+    const FibreAnomalyAlert *alert = &det->alerts[a];
+    if (alert->kind != FIBREANOMALY_STEP) continue;
+    int matched = 0;
+    for (int s = 0; (s < nsteps) && !matched; s++) {
+      if ((steps[s].fibre == alert->fibre) && (alert->time >= steps[s].time) && (steps[s].detected == 0)) {
+        steps[s].detected = alert->time;
+        matched = 1;
+      }
+    }
+    if (!matched) other++;
+  }
+
+  return other;
+}
+
+int main(int argc, char **argv) {
+  const char *outname = NULL;
+  FibreAnomalyConfig config;
+  defaultFibreAnomalyConfig(&config);
+  int fibre_number[MAX_STEPS];
+  float step_hours[MAX_STEPS], step_db[MAX_STEPS];
+  int nsteps = 0;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "o:i:s:k:h:d:t:")) != -1) {
+    switch (opt) {
+      case 'o': outname = optarg; break;
+      case 'i': config.interval = atoi(optarg); break;
+      case 's':
+        if ((nsteps < MAX_STEPS) &&
+            (sscanf(optarg, "%d,%f,%f", &fibre_number[nsteps], &step_hours[nsteps], &step_db[nsteps]) == 3)) {
+          nsteps++;
+        }
+        break;
+      case 'k': config.k = atof(optarg); break;
+      case 'h': config.h = atof(optarg); break;
+      case 'd': config.drift_db = atof(optarg); break;
+      case 't': config.step_db = atof(optarg); break;
+      default:
+        fprintf(stderr, "Use: %s [-o alerts] [-i interval] [-s fibre,hours,dB]... [-k k] [-h h] [-d dB] [-t dB] "
+                        "<fibre map> <log file> [<log file> ...]\n", argv[0]);
+        return 1;
+    }
+  }
+  if (argc - optind < 2) {
+    fprintf(stderr, "Use: %s [-o alerts] [-i interval] [-s fibre,hours,dB]... [-k k] [-h h] [-d dB] [-t dB] "
+                    "<fibre map> <log file> [<log file> ...]\n", argv[0]);
+    return 1;
+  }
+
+  FibreMapEntry *map;
+  int nfibres = readFibreMap(argv[optind], &map);
+  if (nfibres <= 0) {
+    fprintf(stderr, "No fibres in %s\n", argv[optind]);
+    return 1;
+  }
+  FILE *out = (outname != NULL) ? fopen(outname, "w") : stdout;
+  if (out == NULL) {
+    fprintf(stderr, "Cannot write %s\n", outname);
+    return 1;
+  }
+
+  FibreAnomaly det;
+  initFibreAnomaly(&det, &config, map, nfibres, out);
+  Step steps[MAX_STEPS];
+  int start = 0;
+  long nrows = 0, other_steps = 0;
+
+  for (int f = optind + 1; f < argc; f++) {
+    FibreLog log;
+    memset(&log, 0, sizeof(log));
+    if (readFibreLog(argv[f], &log) < 0) {
+      fprintf(stderr, "Cannot read %s\n", argv[f]);
+      continue;
+    }
+    if ((start == 0) && (log.nrows > 0)) {
+      start = log.time[0];
+      for (int s = 0; s < nsteps; s++) {
+        steps[s].fibre = -1;
+        for (int k = 0; k < nfibres; k++) {
+          if (map[k].fibre == fibre_number[s]) steps[s].fibre = k;
+        }
+        steps[s].time = start + (int)(step_hours[s]*3600);
+        steps[s].db = step_db[s];
+        steps[s].detected = 0;
+      }
+    }
+
+    // Fibre received by each hostname:port of this file, for the steps
+    int *rx = (int*)malloc(log.nendpoints*sizeof(int));
+    for (int e = 0; e < log.nendpoints; e++) {
+      int tx;
+      fibreMapFind(map, nfibres, log.endpoints[e].hostname, log.endpoints[e].port, &tx, &rx[e]);
+    }
+
+    for (int pos = 0; pos < log.nrows; pos++) {
+      FibreLogEndpoint *e = &log.endpoints[log.endpoint[pos]];
+      float Prx = log.Prx[pos];
+      for (int s = 0; s < nsteps; s++) {
+        if ((steps[s].fibre == rx[log.endpoint[pos]]) && (log.time[pos] >= steps[s].time)) {
+          Prx -= steps[s].db;
+        }
+      }
+      int last_cycle = det.last_cycle;
+      fibreAnomalySample(&det, e->hostname, e->port, log.time[pos], log.Ptx[pos], Prx);
+      if (det.last_cycle != last_cycle) {
+        other_steps += matchSteps(&det, steps, nsteps);
+      }
+      nrows++;
+    }
+    free(rx);
+    freeFibreLog(&log);
+  }
+  fibreAnomalyFlush(&det, 0);
+  other_steps += matchSteps(&det, steps, nsteps);
+
+  if (nsteps > 0) {
+    int missed = 0;
+    for (int s = 0; s < nsteps; s++) {
+      if (steps[s].detected) {
+        printf("Step of %+.2f dB on fibre %d at %+.1f h: detected %d cycles later\n", steps[s].db, fibre_number[s],
+               step_hours[s], (steps[s].detected - steps[s].time)/config.interval);
+      }
+      else {
+        printf("Step of %+.2f dB on fibre %d at %+.1f h: MISSED\n", steps[s].db, fibre_number[s], step_hours[s]);
+        missed++;
+      }
+    }
+    printf("%ld rows, %ld alerts, %ld STEP alerts not for an added step, %d steps missed\n", nrows, det.total_alerts,
+           other_steps, missed);
+    if (missed > 0) {
+      return 1;
+    }
+  }
+  else {
+    fprintf(stderr, "%ld rows, %ld alerts\n", nrows, det.total_alerts);
+  }
+
+  if (out != stdout) {
+    fclose(out);
+  }
+  freeFibreAnomaly(&det);
+  free(map);
+
+  return 0;
+}
@@ -0,0 +1,267 @@
+/*
+ * FibreCheckpoint.h
+ *
+ * State kept between runs of PlotFibreMonSwitch.C, so that each run only
+ * processes the lines appended to MergedLog.txt since the previous one.
+ *
+ * Two files are kept next to the log:
+ *
+ *  - <log>.checkpoint: text file with the byte offset already processed,
+ *    the first bytes of the log (to spot truncation or rotation), the
+ *    time reference, the last time slot and the values of every fibre
+ *    for that slot (fibres_values_temp in PlotFibreMonSwitch.C).
+ *  - <log>.values: the mapped values of every fibre for every time slot
+ *    already closed, as fixed-size FibreValue records. This replaces the
+ *    "Fibres values" TTree that was rebuilt from scratch on each run.
+ *
+ * If the log is shorter than the offset, starts with different bytes or
+ * the fibre map changed, the checkpoint is not valid and everything is
+ * rebuilt from the beginning of the log.
+ */
+#ifndef FIBRECHECKPOINT_H
+#define FIBRECHECKPOINT_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define FIBRECKPT_HEADLEN 64
+#define FIBRECKPT_NAMELEN 100
+
+/*
+ * Values of one fibre in one time slot, as stored in <log>.values.
+ */
+typedef struct {
+  int fibre_idx;
+  float x;              // Seconds since the first slot
+  float Ptx;
+  float Prx;
+  float temperature;
+  float att;
+} FibreValue;
+
+typedef struct {
+  long offset;                  // Bytes of the log already processed
+  int headlen;
+  unsigned char head[FIBRECKPT_HEADLEN];
+  unsigned int fibremap_hash;
+  int nfibres;
+  int time0;                    // Timestamp of the first row of the log
+  int timeN;                    // Timestamp of the last row processed
+  int line_time;                // Time slot still open
+  long nvalues;                 // Records in <log>.values
+  float (*values)[5];           // Ptx, Prx, Attenuation, Attenuator, Temperature
+  char (*names)[FIBRECKPT_NAMELEN];
+} FibreCheckpoint;
+
+/*
+ * FNV-1a hash, used to notice changes in the fibre map.
+ */
+static unsigned int fibreCheckpointHash(const void *data, int len, unsigned int hash) {
+  const unsigned char *p = (const unsigned char*)data;
+  if (hash == 0) {
+    hash = 2166136261u;
+  }
+  for (int i = 0; i < len; i++) {
+    hash ^= p[i];
+    hash *= 16777619u;
+  }
+
+  return hash;
+}
+
+/*
+ * Allocate an empty checkpoint for nfibres fibres.
+ */
+static void initFibreCheckpoint(FibreCheckpoint *ckpt, int nfibres, unsigned int fibremap_hash) {
+  memset(ckpt, 0, sizeof(FibreCheckpoint));
+  ckpt->nfibres = nfibres;
+  ckpt->fibremap_hash = fibremap_hash;
+  ckpt->values = (float(*)[5])calloc(nfibres, sizeof(*ckpt->values));
+  ckpt->names = (char(*)[FIBRECKPT_NAMELEN])calloc(nfibres, sizeof(*ckpt->names));
+}
+
+static void freeFibreCheckpoint(FibreCheckpoint *ckpt) {
+  free(ckpt->values);
+  free(ckpt->names);
+  ckpt->values = NULL;
+  ckpt->names = NULL;
+}
+
+/*
+ * Read the first bytes of the log file into head. Returns how many.
+ */
+static int fibreCheckpointHead(const char *logfile, unsigned char *head) {
+  FILE *f = fopen(logfile, "rb");
+  if (f == NULL) {
+    return 0;
+  }
+  int n = fread(head, 1, FIBRECKPT_HEADLEN, f);
+  fclose(f);
+
+  return n;
+}
+
+static long fibreCheckpointFileSize(const char *filename) {
+  FILE *f = fopen(filename, "rb");
+  if (f == NULL) {
+    return -1;
+  }
+  fseek(f, 0, SEEK_END);
+  long size = ftell(f);
+  fclose(f);
+
+  return size;
+}
+
+/*
+ * Load the checkpoint for logfile. ckpt must have been initialised with
+ * initFibreCheckpoint() for the current fibre map.
+ * Returns 1 if the checkpoint can be used to resume, 0 if the log has to
+ * be processed from the beginning (no checkpoint, log truncated or
+ * rotated, fibre map changed, values file missing...).
+ */
+static int loadFibreCheckpoint(const char *logfile, FibreCheckpoint *ckpt) {
+  char filename[1000];
+  char line[1000];
+  int nfibres = ckpt->nfibres;
+  unsigned int hash = ckpt->fibremap_hash;
+
+  snprintf(filename, sizeof(filename), "%s.checkpoint", logfile);
+  FILE *f = fopen(filename, "r");
+  if (f == NULL) {
+    return 0;
+  }
+
+  int valid = 1;
+  int fibres_read = 0;
+  while (valid && (fgets(line, sizeof(line), f) != NULL)) {
+    char key[32], hex[2*FIBRECKPT_HEADLEN + 1];
+    if ((line[0] == '#') || (sscanf(line, "%31s", key) != 1)) {
+      continue;
+    }
+    if (strcmp(key, "offset") == 0) {
+      valid = (sscanf(line, "%*s %ld", &ckpt->offset) == 1);
+    } else if (strcmp(key, "head") == 0) {
+      hex[0] = '\0';
+      sscanf(line, "%*s %128s", hex);
+      ckpt->headlen = strlen(hex)/2;
+      for (int i = 0; i < ckpt->headlen; i++) {
+        unsigned int byte;
+        sscanf(hex + 2*i, "%2x", &byte);
+        ckpt->head[i] = byte;
+      }
+    } else if (strcmp(key, "fibremap") == 0) {
+      unsigned int h;
+      int n;
+      valid = (sscanf(line, "%*s %x %d", &h, &n) == 2) && (h == hash) && (n == nfibres);
+    } else if (strcmp(key, "time0") == 0) {
+      valid = (sscanf(line, "%*s %d", &ckpt->time0) == 1);
+    } else if (strcmp(key, "timeN") == 0) {
+      valid = (sscanf(line, "%*s %d", &ckpt->timeN) == 1);
+    } else if (strcmp(key, "line_time") == 0) {
+      valid = (sscanf(line, "%*s %d", &ckpt->line_time) == 1);
+    } else if (strcmp(key, "nvalues") == 0) {
+      valid = (sscanf(line, "%*s %ld", &ckpt->nvalues) == 1);
+    } else if (strcmp(key, "fibre") == 0) {
+      int k;
+      float v[5];
+      char name[FIBRECKPT_NAMELEN];
+      valid = (sscanf(line, "%*s %d %g %g %g %g %g %99s", &k, &v[0], &v[1], &v[2], &v[3], &v[4], name) == 7) &&
+              (k >= 0) && (k < nfibres);
+      if (valid) {
+        memcpy(ckpt->values[k], v, sizeof(v));
+        strcpy(ckpt->names[k], strcmp(name, "-") == 0 ? "" : name);
+        fibres_read++;
+      }
+    }
+  }
+  fclose(f);
+
+  if (!valid || (fibres_read != nfibres) || (ckpt->offset <= 0)) {
+    return 0;
+  }
+
+  // Has the log been truncated or replaced since?
+  unsigned char head[FIBRECKPT_HEADLEN];
+  if (fibreCheckpointFileSize(logfile) < ckpt->offset) {
+    return 0;
+  }
+  if ((fibreCheckpointHead(logfile, head) < ckpt->headlen) || (memcmp(head, ckpt->head, ckpt->headlen) != 0)) {
+    return 0;
+  }
+
+  // The values file must have at least the records of the checkpoint
+  snprintf(filename, sizeof(filename), "%s.values", logfile);
+  if (fibreCheckpointFileSize(filename) < ckpt->nvalues*(long)sizeof(FibreValue)) {
+    return 0;
+  }
+
+  return 1;
+}
+
+/*
+ * Write the checkpoint for logfile. The file is replaced atomically, so
+ * an interrupted run leaves the previous checkpoint in place.
+ * Returns 1 on success.
+ */
+static int saveFibreCheckpoint(const char *logfile, FibreCheckpoint *ckpt) {
+  char filename[1000], tmpname[1000];
+  snprintf(filename, sizeof(filename), "%s.checkpoint", logfile);
+  snprintf(tmpname, sizeof(tmpname), "%s.checkpoint.tmp", logfile);
+
+  ckpt->headlen = fibreCheckpointHead(logfile, ckpt->head);
+  if (ckpt->headlen > ckpt->offset) {
+    ckpt->headlen = ckpt->offset;
+  }
+
+  FILE *f = fopen(tmpname, "w");
+  if (f == NULL) {
+    return 0;
+  }
+  fprintf(f, "# Checkpoint of %s for PlotFibreMonSwitch.C. Delete to rebuild.\n", logfile);
+  fprintf(f, "offset %ld\n", ckpt->offset);
+  fprintf(f, "head ");
+  for (int i = 0; i < ckpt->headlen; i++) {
+    fprintf(f, "%02x", ckpt->head[i]);
+  }
+  fprintf(f, "\n");
+  fprintf(f, "fibremap %08x %d\n", ckpt->fibremap_hash, ckpt->nfibres);
+  fprintf(f, "time0 %d\n", ckpt->time0);
+  fprintf(f, "timeN %d\n", ckpt->timeN);
+  fprintf(f, "line_time %d\n", ckpt->line_time);
+  fprintf(f, "nvalues %ld\n", ckpt->nvalues);
+  for (int k = 0; k < ckpt->nfibres; k++) {
+    fprintf(f, "fibre %d %.9g %.9g %.9g %.9g %.9g %s\n", k,
+            ckpt->values[k][0], ckpt->values[k][1], ckpt->values[k][2], ckpt->values[k][3], ckpt->values[k][4],
+            ckpt->names[k][0] ? ckpt->names[k] : "-");
+  }
+  if (fclose(f) != 0) {
+    return 0;
+  }
+
+  return rename(tmpname, filename) == 0;
+}
+
+/*
+ * Open <log>.values for appending after the first nvalues records,
+ * dropping anything after them (left by an interrupted run).
+ */
+static FILE *openFibreValues(const char *logfile, long nvalues) {
+  char filename[1000];
+  snprintf(filename, sizeof(filename), "%s.values", logfile);
+  FILE *f = fopen(filename, nvalues > 0 ? "r+b" : "w+b");
+  if (f == NULL) {
+    return NULL;
+  }
+  if (ftruncate(fileno(f), nvalues*(long)sizeof(FibreValue)) != 0) {
+    fclose(f);
+    return NULL;
+  }
+  fseek(f, 0, SEEK_END);
+
+  return f;
+}
+
+#endif
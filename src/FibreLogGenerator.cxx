@@ -0,0 +1,204 @@
+/*
+ * FibreLogGenerator
+ *
+ * Use:
+ *
+ *  - FibreLogGenerator [options]
+ *
+ * Writes a synthetic MergedLog.txt and the fibre map that goes with it,
+ * to see how the programs cope with more switches, ports and months than
+ * we have. Every port of every switch transmits on one fibre and receives
+ * another one (from the same port of the next switch), so there are
+ * switches*ports fibres. Switches are named bismonitorsw001, ... so that
+ * no name is part of another one (the map is matched with strstr()).
+ *
+ * The values look like the real ones: Ptx around -5.5 dBm, an attenuation
+ * per fibre that drifts a little and sometimes jumps, temperatures
+ * following the day, and some noise. Like the real log, it also has:
+ *
+ *  - gaps: a switch not read for a while (1 to 36 cycles),
+ *  - duplicate timestamps: the rows of a switch written twice,
+ *  - Error retries: an "Error" line, and the rows one minute later.
+ *
+ * Options:
+ *
+ *  -w switches  Number of switches. Default: 3.
+ *  -p ports     Ports per switch with a fibre. Default: 3.
+ *  -m months    Months of data (30 days each). Default: 1.
+ *  -i minutes   Minutes between read-outs. Default: 10.
+ *  -t date      First date, YYYY.MM.DD. Default: 2014.06.16.
+ *  -g prob      Probability of a gap starting, per switch and cycle. Default: 0.001.
+ *  -d prob      Probability of duplicate rows, per switch and cycle. Default: 0.002.
+ *  -e prob      Probability of an Error retry, per switch and cycle. Default: 0.01.
+ *  -s seed      Random seed. Default: 1.
+ *  -o file      Log file. Default: MergedLog.txt.
+ *  -f file      Fibre map. Default: fibremap.txt.
+ *
+ * Compile with:
+ *
+ *  g++ -O2 -o FibreLogGenerator FibreLogGenerator.cxx
+ */
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "FibreLogReader.h"
+
+static const char *month_names[12] = {"Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"};
+
+typedef struct {
+  float Ptx;                    // Transmitter of the port
+  float temp;
+  float current;
+  int gap;                      // Cycles left without read-out (whole switch, kept in port 0)
+} Port;
+
+typedef struct {
+  float att;                    // Attenuation of the fibre itself
+  float drift;                  // dB per cycle
+  float attenuator;
+} Fibre;
+
+static double uniform() {
+  return (rand() + 0.5)/((double)RAND_MAX + 1);
+}
+
+static double gauss(double sigma) {
+  return sigma*sqrt(-2*log(uniform()))*cos(2*M_PI*uniform());
+}
+
+int main(int argc, char **argv) {
+  int nswitches = 3;
+  int nports = 3;
+  int months = 1;
+  int interval = 10;
+  const char *start = "2014.06.16";
+  double p_gap = 0.001, p_dup = 0.002, p_error = 0.01;
+  unsigned int seed = 1;
+  const char *logname = "MergedLog.txt";
+  const char *mapname = "fibremap.txt";
+  int opt;
+
+  while ((opt = getopt(argc, argv, "w:p:m:i:t:g:d:e:s:o:f:")) != -1) {
+    switch (opt) {
+      case 'w': nswitches = atoi(optarg); break;
+      case 'p': nports = atoi(optarg); break;
+      case 'm': months = atoi(optarg); break;
+      case 'i': interval = atoi(optarg); break;
+      case 't': start = optarg; break;
+      case 'g': p_gap = atof(optarg); break;
+      case 'd': p_dup = atof(optarg); break;
+      case 'e': p_error = atof(optarg); break;
+      case 's': seed = atoi(optarg); break;
+      case 'o': logname = optarg; break;
+      case 'f': mapname = optarg; break;
+      default:
+        fprintf(stderr, "Use: %s [-w switches] [-p ports] [-m months] [-i minutes] [-t YYYY.MM.DD] [-g prob] [-d prob] "
+                        "[-e prob] [-s seed] [-o log] [-f fibremap]\n", argv[0]);
+        return 1;
+    }
+  }
+  int y, m, d;
+  if ((nswitches <= 0) || (nports <= 0) || (months <= 0) || (interval <= 0) ||
+      (sscanf(start, "%d.%d.%d", &y, &m, &d) != 3)) {
+    fprintf(stderr, "Wrong options\n");
+    return 1;
+  }
+  srand(seed);
+
+  // Fibre k goes from port p of switch s to port p of switch s + 1
+  int nfibres = nswitches*nports;
+  Port *ports = (Port*)calloc(nfibres, sizeof(Port));
+  Fibre *fibres = (Fibre*)calloc(nfibres, sizeof(Fibre));
+  FILE *map = fopen(mapname, "w");
+  if (map == NULL) {
+    fprintf(stderr, "Cannot write %s\n", mapname);
+    return 1;
+  }
+  fprintf(map, "# Synthetic fibre map written by FibreLogGenerator\n");
+  fprintf(map, "#fibre\ttxsw\ttxport\trxsw\trxport\tfibrename\tattenuator\n");
+  for (int s = 0; s < nswitches; s++) {
+    for (int p = 0; p < nports; p++) {
+      int k = s*nports + p;
+      int to = (s + 1)%nswitches;
+      ports[k].Ptx = -5.5 + gauss(0.3);
+      ports[k].temp = 36 + gauss(1);
+      ports[k].current = 14.5 + gauss(0.5);
+      fibres[k].att = 2 + 8*uniform();
+      fibres[k].drift = gauss(2e-5);
+      fibres[k].attenuator = (uniform() < 0.5) ? 0 : 10;
+      fprintf(map, "%d\tbismonitorsw%03d\t%d\tbismonitorsw%03d\t%d\tF%04d_SW%dtoSW%d\t%g\n", k + 1, s + 1, p + 1, to + 1, p + 1,
+              k + 1, s + 1, to + 1, fibres[k].attenuator);
+    }
+  }
+  fclose(map);
+
+  FILE *log = fopen(logname, "w");
+  if (log == NULL) {
+    fprintf(stderr, "Cannot write %s\n", logname);
+    return 1;
+  }
+  setvbuf(log, NULL, _IOFBF, 1 << 20);
+
+  int time0 = fibreLogDaysFromCivil(y, m, d)*86400;
+  long ncycles = (long)months*30*24*60/interval;
+  long nrows = 0, ngaps = 0, ndups = 0, nerrors = 0;
+  for (long c = 0; c < ncycles; c++) {
+    // Fibres change a bit every cycle, whether they are read or not
+    for (int k = 0; k < nfibres; k++) {
+      fibres[k].att += fibres[k].drift;
+      if (uniform() < 1e-5) {
+        fibres[k].att += gauss(1);
+      }
+    }
+
+    for (int s = 0; s < nswitches; s++) {
+      Port *first = &ports[s*nports];
+      if (first->gap > 0) {
+        first->gap--;
+        continue;
+      }
+      if (uniform() < p_gap) {
+        first->gap = 1 + rand()%36;
+        ngaps++;
+        continue;
+      }
+
+      int time = time0 + (int)(c*interval*60);
+      if (uniform() < p_error) {    // The Error line, and the retry a minute later
+        fprintf(log, "Error\n");
+        nerrors++;
+        time += 60;
+      }
+      int year, month, day, hour, minute;
+      fibreLogCivil(time, &year, &month, &day, &hour, &minute);
+      double daily = sin(2*M_PI*((hour*60 + minute)/1440.0 - 0.25));
+
+      int copies = (uniform() < p_dup) ? 2 : 1;
+      ndups += copies - 1;
+      for (int copy = 0; copy < copies; copy++) {
+        for (int p = 0; p < nports; p++) {
+          int k = s*nports + p;
+          int from = ((s + nswitches - 1)%nswitches)*nports + p;    // Fibre received on this port
+          float temp = ports[k].temp + 2*daily + gauss(0.1);
+          float Ptx = ports[k].Ptx + gauss(0.02);
+          float Prx = ports[from].Ptx - fibres[from].att - fibres[from].attenuator + gauss(0.03);
+          fprintf(log, "%s %02d %02d:%02d:00\tbismonitorsw%03d:%d\t%04d.%02d.%02d %02d:%02d.00\t%.2f\t%.2f\t%.2f\t%.2f\t%.2f\n",
+                  month_names[month - 1], day, hour, minute, s + 1, p + 1, year, month, day, hour, minute,
+                  temp, 3.29 + gauss(0.005), ports[k].current + gauss(0.05), Ptx, Prx);
+          nrows++;
+        }
+      }
+    }
+  }
+  fclose(log);
+
+  printf("%s: %ld rows, %d fibres, %ld cycles, %ld gaps, %ld duplicates, %ld Error retries\n", logname, nrows, nfibres,
+         ncycles, ngaps, ndups, nerrors);
+  free(ports);
+  free(fibres);
+
+  return 0;
+}
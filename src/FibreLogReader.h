@@ -0,0 +1,378 @@
+/*
+ * FibreLogReader.h
+ *
+ * Native reader for the MergedLog.txt file written by ProcessData.sh.
+ * Replaces TTree::ReadFile and the per-row getTimestamp()/strtok() calls.
+ *
+ * Each row of the log looks like:
+ *
+ *   Jun 16 10:20:00 <tab> bismonitorsw1:2 <tab> 2014.06.16 10:20.00 <tab> temp voltage current Ptx Prx
+ *
+ * The rows end up in contiguous typed columns (one array per field). The
+ * "hostname:port" column is split once and interned (in a hash table, so
+ * thousands of ports cost the same as a few), and every row only keeps
+ * an endpoint ID.
+ *
+ * Timestamps are computed from the fixed-width date and time fields with
+ * plain calendar arithmetic (no mktime()). The seconds for the start of
+ * the day are cached, since consecutive rows almost always share the date.
+ * The result is the logged wall-clock time expressed as seconds since
+ * 1970-01-01 00:00, without time zone or DST corrections.
+ *
+ * Lines that do not have all the fields (e.g. "Error" lines that slipped
+ * into the log) are skipped.
+ *
+ * readFibreLogFrom() starts at a byte offset and stops after the last
+ * complete line, so a log that is still being appended to can be read
+ * a bit at a time (see FibreCheckpoint.h).
+ */
+#ifndef FIBRELOGREADER_H
+#define FIBRELOGREADER_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "FibreCheckpoint.h"
+
+#define FIBRELOG_HOSTLEN 100
+#define FIBRELOG_FIELDS 11
+#define FIBRELOG_CHUNK (1 << 20)
+
+/*
+ * A switch port as found in the log ("hostname:port").
+ * port is -1 if the log entry had no port.
+ */
+typedef struct {
+  char hostname[FIBRELOG_HOSTLEN];
+  int port;
+} FibreLogEndpoint;
+
+/*
+ * Contents of the log file, one array per column.
+ */
+typedef struct {
+  int nrows;
+  int capacity;
+  int *time;          // Seconds since 1970-01-01 00:00 (wall clock as logged)
+  int *endpoint;      // Index in endpoints[]
+  float *temp;
+  float *voltage;
+  float *current;
+  float *Ptx;
+  float *Prx;
+
+  int nendpoints;
+  int endpoints_capacity;
+  FibreLogEndpoint *endpoints;
+  int *endpoint_table;          // Open addressing: ID + 1, 0 if free
+  int endpoint_table_size;
+
+  long offset;        // Byte offset right after the last line read
+
+  // Cache for the timestamp of the start of the day
+  char last_date[10];
+  int last_daybase;
+} FibreLog;
+
+/*
+ * Days since 1970-01-01 for a date in the proleptic Gregorian calendar.
+ */
+static int fibreLogDaysFromCivil(int y, int m, int d) {
+  y -= m <= 2;
+  int era = (y >= 0 ? y : y - 399)/400;
+  int yoe = y - era*400;
+  int doy = (153*(m + (m > 2 ? -3 : 9)) + 2)/5 + d - 1;
+  int doe = yoe*365 + yoe/4 - yoe/100 + doy;
+
+  return era*146097 + doe - 719468;
+}
+
+/*
+ * Inverse of fibreLogDaysFromCivil() and the timestamps in the log: fill
+ * in year, month (1-12), day, hour and minute for a FibreLog timestamp.
+ */
+static void fibreLogCivil(int ts, int *year, int *month, int *day, int *hour, int *minute) {
+  int days = ts/86400;
+  int secs = ts%86400;
+  if (secs < 0) {
+    secs += 86400;
+    days--;
+  }
+  days += 719468;
+  int era = (days >= 0 ? days : days - 146096)/146097;
+  int doe = days - era*146097;
+  int yoe = (doe - doe/1460 + doe/36524 - doe/146096)/365;
+  int doy = doe - (365*yoe + yoe/4 - yoe/100);
+  int mp = (5*doy + 2)/153;
+  int m = mp + (mp < 10 ? 3 : -9);
+
+  *year = yoe + era*400 + (m <= 2);
+  *month = m;
+  *day = doy - (153*mp + 2)/5 + 1;
+  *hour = secs/3600;
+  *minute = secs%3600/60;
+}
+
+static inline int fibreLogDigits2(const char *s) {
+  return (s[0] - '0')*10 + (s[1] - '0');
+}
+
+/*
+ * Timestamp for a date "YYYY.MM.DD" and a time "HH:MM..." from the log.
+ * Returns -1 if the fields are not in the expected format.
+ */
+static int fibreLogTimestamp(FibreLog *log, const char *date, int datelen, const char *time, int timelen) {
+  if (datelen < 10 || timelen < 5) {
+    return -1;
+  }
+  for (int i = 0; i < 10; i++) {
+    if ((i == 4) || (i == 7)) continue;
+    if ((date[i] < '0') || (date[i] > '9')) return -1;
+  }
+  if ((time[0] < '0') || (time[0] > '9') || (time[1] < '0') || (time[1] > '9') ||
+      (time[3] < '0') || (time[3] > '9') || (time[4] < '0') || (time[4] > '9')) {
+    return -1;
+  }
+
+  if (memcmp(log->last_date, date, 10) != 0) {
+    int y = fibreLogDigits2(date)*100 + fibreLogDigits2(date + 2);
+    log->last_daybase = fibreLogDaysFromCivil(y, fibreLogDigits2(date + 5), fibreLogDigits2(date + 8))*86400;
+    memcpy(log->last_date, date, 10);
+  }
+
+  return log->last_daybase + fibreLogDigits2(time)*3600 + fibreLogDigits2(time + 3)*60;
+}
+
+/*
+ * Parse a decimal number like "-5.43". Falls back to strtod() for
+ * anything fancier (exponents, nan, ...).
+ */
+static float fibreLogFloat(const char *s, int len) {
+  const char *p = s;
+  const char *end = s + len;
+  int negative = 0;
+  if ((p < end) && ((*p == '-') || (*p == '+'))) {
+    negative = (*p == '-');
+    p++;
+  }
+  if (p == end) {
+    return 0;
+  }
+  double value = 0;
+  double scale = 1;
+  int dot = 0;
+  for (; p < end; p++) {
+    if ((*p >= '0') && (*p <= '9')) {
+      value = value*10 + (*p - '0');
+      if (dot) scale *= 10;
+    } else if ((*p == '.') && !dot) {
+      dot = 1;
+    } else {
+      char temp[64];
+      if (len > 63) len = 63;
+      memcpy(temp, s, len);
+      temp[len] = '\0';
+      return (float)strtod(temp, NULL);
+    }
+  }
+  value /= scale;
+
+  return (float)(negative ? -value : value);
+}
+
+static unsigned int fibreLogEndpointHash(const char *hostname, int hostlen, int port) {
+  unsigned int hash = fibreCheckpointHash(hostname, hostlen, 0);
+
+  return fibreCheckpointHash(&port, sizeof(port), hash);
+}
+
+/*
+ * Get the ID of "hostname:port", adding it to the endpoint table if
+ * it is the first time it is seen.
+ */
+static int fibreLogEndpoint(FibreLog *log, const char *token, int len) {
+  int hostlen = 0;
+  int port = -1;
+  while ((hostlen < len) && (token[hostlen] != ':')) hostlen++;
+  if (hostlen < len) {
+    port = atoi(token + hostlen + 1);
+  }
+  if (hostlen >= FIBRELOG_HOSTLEN) {
+    hostlen = FIBRELOG_HOSTLEN - 1;
+  }
+
+  unsigned int hash = fibreLogEndpointHash(token, hostlen, port);
+  int mask = log->endpoint_table_size - 1;
+  if (log->endpoint_table_size > 0) {
+    for (int i = hash & mask; log->endpoint_table[i] != 0; i = (i + 1) & mask) {
+      FibreLogEndpoint *e = &log->endpoints[log->endpoint_table[i] - 1];
+      if ((e->port == port) && (strncmp(e->hostname, token, hostlen) == 0) && (e->hostname[hostlen] == '\0')) {
+        return log->endpoint_table[i] - 1;
+      }
+    }
+  }
+
+  // New one: keep the table at most half full
+  if (2*(log->nendpoints + 1) > log->endpoint_table_size) {
+    free(log->endpoint_table);
+    log->endpoint_table_size = log->endpoint_table_size ? 2*log->endpoint_table_size : 64;
+    log->endpoint_table = (int*)calloc(log->endpoint_table_size, sizeof(int));
+    mask = log->endpoint_table_size - 1;
+    for (int id = 0; id < log->nendpoints; id++) {
+      FibreLogEndpoint *e = &log->endpoints[id];
+      int i = fibreLogEndpointHash(e->hostname, strlen(e->hostname), e->port) & mask;
+      while (log->endpoint_table[i] != 0) i = (i + 1) & mask;
+      log->endpoint_table[i] = id + 1;
+    }
+  }
+  if (log->nendpoints == log->endpoints_capacity) {
+    log->endpoints_capacity = log->endpoints_capacity ? 2*log->endpoints_capacity : 16;
+    log->endpoints = (FibreLogEndpoint*)realloc(log->endpoints, log->endpoints_capacity*sizeof(FibreLogEndpoint));
+  }
+  FibreLogEndpoint *e = &log->endpoints[log->nendpoints];
+  memcpy(e->hostname, token, hostlen);
+  e->hostname[hostlen] = '\0';
+  e->port = port;
+  int i = hash & mask;
+  while (log->endpoint_table[i] != 0) i = (i + 1) & mask;
+  log->endpoint_table[i] = log->nendpoints + 1;
+
+  return log->nendpoints++;
+}
+
+static void fibreLogGrow(FibreLog *log) {
+  int n = log->capacity ? 2*log->capacity : 4096;
+  log->time = (int*)realloc(log->time, n*sizeof(int));
+  log->endpoint = (int*)realloc(log->endpoint, n*sizeof(int));
+  log->temp = (float*)realloc(log->temp, n*sizeof(float));
+  log->voltage = (float*)realloc(log->voltage, n*sizeof(float));
+  log->current = (float*)realloc(log->current, n*sizeof(float));
+  log->Ptx = (float*)realloc(log->Ptx, n*sizeof(float));
+  log->Prx = (float*)realloc(log->Prx, n*sizeof(float));
+  log->capacity = n;
+}
+
+/*
+ * Parse one line (without the newline) and append it to the columns.
+ * Returns 1 if the row was added, 0 if the line was skipped.
+ */
+static int fibreLogParseLine(FibreLog *log, const char *line, int len) {
+  const char *tok[FIBRELOG_FIELDS];
+  int toklen[FIBRELOG_FIELDS];
+  int ntok = 0;
+  int i = 0;
+
+  // Same field splitting as ReadFile: any run of blanks separates fields
+  while ((i < len) && (ntok < FIBRELOG_FIELDS)) {
+    while ((i < len) && ((line[i] == ' ') || (line[i] == '\t') || (line[i] == '\r'))) i++;
+    if (i == len) break;
+    tok[ntok] = line + i;
+    while ((i < len) && (line[i] != ' ') && (line[i] != '\t') && (line[i] != '\r')) i++;
+    toklen[ntok] = line + i - tok[ntok];
+    ntok++;
+  }
+  if (ntok < FIBRELOG_FIELDS) {
+    return 0;
+  }
+
+  // month day time hostname date t2 temp voltage current Ptx Prx
+  int ts = fibreLogTimestamp(log, tok[4], toklen[4], tok[2], toklen[2]);
+  if (ts < 0) {
+    return 0;
+  }
+
+  if (log->nrows == log->capacity) {
+    fibreLogGrow(log);
+  }
+  int n = log->nrows;
+  log->time[n] = ts;
+  log->endpoint[n] = fibreLogEndpoint(log, tok[3], toklen[3]);
+  log->temp[n] = fibreLogFloat(tok[6], toklen[6]);
+  log->voltage[n] = fibreLogFloat(tok[7], toklen[7]);
+  log->current[n] = fibreLogFloat(tok[8], toklen[8]);
+  log->Ptx[n] = fibreLogFloat(tok[9], toklen[9]);
+  log->Prx[n] = fibreLogFloat(tok[10], toklen[10]);
+  log->nrows++;
+
+  return 1;
+}
+
+/*
+ * Read the log file from byte offset "from" into the columns of log
+ * (which must be zeroed or freshly cleared). Only complete lines are
+ * read, unless "all" is set, in which case a last line without newline
+ * is read too. log->offset is left after the last line read.
+ * Returns the number of rows, or -1 if the file cannot be opened.
+ */
+static int readFibreLogFrom(const char *filename, long from, int all, FibreLog *log) {
+  FILE *f = fopen(filename, "rb");
+  if (f == NULL) {
+    return -1;
+  }
+  if ((from > 0) && (fseek(f, from, SEEK_SET) != 0)) {
+    fclose(f);
+    return -1;
+  }
+  log->offset = from;
+
+  char *buf = (char*)malloc(FIBRELOG_CHUNK + 1);
+  int used = 0;
+  size_t got;
+  while ((got = fread(buf + used, 1, FIBRELOG_CHUNK - used, f)) > 0 || used > 0) {
+    int len = used + got;
+    int start = 0;
+    for (int i = 0; i < len; i++) {
+      if (buf[i] == '\n') {
+        fibreLogParseLine(log, buf + start, i - start);
+        start = i + 1;
+      }
+    }
+    if (got == 0) {   // Last line without a newline
+      if (all) {
+        fibreLogParseLine(log, buf + start, len - start);
+        start = len;
+      }
+      log->offset += start;
+      break;
+    }
+    if (start == 0 && len == FIBRELOG_CHUNK) {   // Line longer than the buffer: drop it
+      start = len;
+    }
+    log->offset += start;
+    used = len - start;
+    memmove(buf, buf + start, used);
+  }
+
+  free(buf);
+  fclose(f);
+
+  return log->nrows;
+}
+
+/*
+ * Read the whole log file into the columns of log (which must be zeroed
+ * or freshly cleared). Returns the number of rows, or -1 if the file
+ * cannot be opened.
+ */
+static int readFibreLog(const char *filename, FibreLog *log) {
+  return readFibreLogFrom(filename, 0, 1, log);
+}
+
+/*
+ * Free the columns, leaving log empty.
+ */
+static void freeFibreLog(FibreLog *log) {
+  free(log->time);
+  free(log->endpoint);
+  free(log->temp);
+  free(log->voltage);
+  free(log->current);
+  free(log->Ptx);
+  free(log->Prx);
+  free(log->endpoints);
+  free(log->endpoint_table);
+  memset(log, 0, sizeof(FibreLog));
+}
+
+#endif
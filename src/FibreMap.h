@@ -0,0 +1,100 @@
+/*
+ * FibreMap.h
+ *
+ * Reader for the fibre map (conf/fibremap.txt) for the compiled programs,
+ * which can't use TTree::ReadFile like PlotFibreMonSwitch.C. Each line
+ * that is not a comment has:
+ *
+ *   fibre  txswitch  txport  rxswitch  rxport  fibrename  attenuator
+ *
+ * A log endpoint "hostname:port" belongs to a fibre as transmitter if the
+ * hostname contains txswitch and the port is txport (same as in
+ * PlotFibreMonSwitch.C), and likewise as receiver.
+ */
+#ifndef FIBREMAP_H
+#define FIBREMAP_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "FibreCheckpoint.h"
+
+typedef struct {
+  int fibre;
+  char fromSw[100];
+  int fromPort;
+  char toSw[100];
+  int toPort;
+  char fibrename[100];
+  float attenuator;
+} FibreMapEntry;
+
+/*
+ * Read the fibre map. Returns the number of fibres (entries in *map, to
+ * be freed by the caller), -1 if the file can't be read.
+ */
+static int readFibreMap(const char *filename, FibreMapEntry **map) {
+  FILE *f = fopen(filename, "r");
+  *map = NULL;
+  if (f == NULL) {
+    return -1;
+  }
+  int n = 0, capacity = 0;
+  char line[1000];
+  while (fgets(line, sizeof(line), f) != NULL) {
+    if (line[strspn(line, " \t")] == '#') {
+      continue;
+    }
+    FibreMapEntry e;
+    if (sscanf(line, "%d %99s %d %99s %d %99s %f", &e.fibre, e.fromSw, &e.fromPort, e.toSw, &e.toPort,
+               e.fibrename, &e.attenuator) != 7) {
+      continue;
+    }
+    if (n == capacity) {
+      capacity = capacity ? 2*capacity : 16;
+      *map = (FibreMapEntry*)realloc(*map, capacity*sizeof(FibreMapEntry));
+    }
+    (*map)[n++] = e;
+  }
+  fclose(f);
+
+  return n;
+}
+
+/*
+ * Hash of the fibre map, the same as the one PlotFibreMonSwitch.C keeps
+ * in the checkpoint.
+ */
+static unsigned int fibreMapHash(const FibreMapEntry *map, int n) {
+  unsigned int hash = 0;
+  for (int k = 0; k < n; k++) {
+    const FibreMapEntry *e = &map[k];
+    hash = fibreCheckpointHash(e->fromSw, strlen(e->fromSw), hash);
+    hash = fibreCheckpointHash(&e->fromPort, sizeof(e->fromPort), hash);
+    hash = fibreCheckpointHash(e->toSw, strlen(e->toSw), hash);
+    hash = fibreCheckpointHash(&e->toPort, sizeof(e->toPort), hash);
+    hash = fibreCheckpointHash(e->fibrename, strlen(e->fibrename), hash);
+    hash = fibreCheckpointHash(&e->attenuator, sizeof(e->attenuator), hash);
+  }
+
+  return hash;
+}
+
+/*
+ * Fibres with hostname:port as transmitter and as receiver, -1 if none.
+ */
+static void fibreMapFind(const FibreMapEntry *map, int n, const char *hostname, int port, int *tx, int *rx) {
+  *tx = -1;
+  *rx = -1;
+  for (int k = 0; k < n; k++) {
+    if ((strstr(hostname, map[k].fromSw) != NULL) && ((port == -1) || (port == map[k].fromPort))) {
+      *tx = k;
+    }
+    if ((strstr(hostname, map[k].toSw) != NULL) && ((port == -1) || (port == map[k].toPort))) {
+      *rx = k;
+    }
+  }
+}
+
+#endif
@@ -0,0 +1,52 @@
+/*
+ * FibreMonitorClient
+ *
+ * Use:
+ *
+ *  - FibreMonitorClient [-S socket] [-t seconds] "command"
+ *
+ * Sends one command to FibreMonitorDaemon (SAMPLE, SYNC, RENDER, QUERY,
+ * STATUS, see FibreMonitorDaemon.cxx), prints the answer and exits with
+ * 0 if it is OK, 1 if it is ERR or there is no daemon. The command goes
+ * in one argument, e.g. "QUERY -24h now F0001".
+ *
+ * It does not use ROOT, so it starts at once: FibreMonitorSwitches.sh
+ * runs it after every cycle.
+ *
+ * Options:
+ *
+ *  -S file      Socket. Default: FibreMonitor.sock.
+ *  -t seconds   Give up if there is no answer after "seconds". Default:
+ *               300, 0 to wait for ever.
+ *
+ * Compile with:
+ *
+ *  g++ -O2 -o FibreMonitorClient FibreMonitorClient.cxx
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "FibreMonitorSocket.h"
+
+int main(int argc, char **argv) {
+  const char *sockname = FIBREMONITOR_SOCKET;
+  int timeout_s = 300;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "S:t:")) != -1) {
+    switch (opt) {
+      case 'S': sockname = optarg; break;
+      case 't': timeout_s = atoi(optarg); break;
+      default:
+        fprintf(stderr, "Use: %s [-S socket] [-t seconds] \"command\"\n", argv[0]);
+        return 1;
+    }
+  }
+  if (argc - optind != 1) {
+    fprintf(stderr, "Use: %s [-S socket] [-t seconds] \"command\"\n", argv[0]);
+    return 1;
+  }
+
+  return sendFibreMonitorCommand(sockname, argv[optind], timeout_s, stdout);
+}
@@ -0,0 +1,985 @@
+/*
+ * FibreMonitorDaemon
+ *
+ * Use:
+ *
+ *  - FibreMonitorDaemon [options]
+ *
+ * Does what "root -b -q PlotFibreMonSwitch.C(-1)" does after each cycle of
+ * FibreMonitorSwitches.sh, but stays running, so ROOT is loaded and the
+ * code compiled only once instead of at every cycle:
+ *
+ *  - the fibre map is read once, at the start,
+ *  - the last days of every fibre are kept in memory (FibreRing.h), read
+ *    from the end of the log at the start (all of it if there are no
+ *    tiers yet),
+ *  - the lines appended to the log are read as they come (every few
+ *    seconds, or at once with SYNC). Lines can also be sent through the
+ *    socket with SAMPLE,
+ *  - the hourly and daily tiers of FibreRollup.h (<log>.hourly,
+ *    <log>.daily) get each time slot when it closes, as the macro does,
+ *    with the same time slots (from the first line of the log),
+ *  - the PNGs are drawn again once the log has been quiet for a while
+ *    after new lines, and only the ones whose points changed. They are
+ *    the same as those of PlotFibreMonSwitch.C, with the same names:
+ *    windows with more time slots than pixels, and "all data" when the
+ *    log is longer than what is kept, are drawn from the tiers,
+ *  - local programs can ask for the values of a time range through a
+ *    Unix socket.
+ *
+ * Commands, one per line (the answer ends with a line "OK ..." or
+ * "ERR ..."). Answers are sent as the client takes them, so a slow client
+ * does not hold up the others; one that neither sends nor takes anything
+ * for 30 seconds is dropped:
+ *
+ *  SAMPLE <line>             Add a line in the format of MergedLog.txt.
+ *  SYNC                      Read the new lines of the log now, and draw
+ *                            the plots that changed.
+ *  RENDER                    Draw all the plots.
+ *  QUERY <from> <to> [fibre] Values of the slots from "from" to "to", a
+ *                            line per slot and fibre: date, fibre name,
+ *                            attenuation, Ptx, Prx and temperature. Times
+ *                            are YYYY.MM.DD-HH:MM, "now", or -Nh / -Nd
+ *                            from now (the end of the last slot). Fibre
+ *                            is its number or name, all by default.
+ *  STATUS                    Slots kept, lines read, plots drawn and
+ *                            skipped, CPU time used and peak RSS.
+ *
+ * Options:
+ *
+ *  -l file      Log file to follow. Default: MergedLog.txt.
+ *  -m file      Fibre map. Default: fibremap.txt.
+ *  -S file      Socket. Default: FibreMonitor.sock.
+ *  -d days      Days kept in memory, for QUERY and the plots drawn from
+ *               time slots. Default: 30.
+ *  -i minutes   Minutes per time slot. Default: 10.
+ *  -w windows   Plot windows, as in PlotFibreMonSwitch.C: hours, or days
+ *               with "d", 0 for all data. Default: "0,24,12".
+ *  -W width     Width of the PNGs in pixels. Default: 1400.
+ *  -H height    Height of the PNGs in pixels. Default: 900.
+ *  -f seconds   Look at the log every "seconds" seconds. Default: 5.
+ *  -q seconds   Draw when the log has been quiet for "seconds" seconds.
+ *               Default: 30.
+ *
+ * Start it once, e.g. from the crontab of pi:
+ *
+ *  @reboot cd /home/pi/SwitchReading && ./FibreMonitorDaemon >> FibreMonitorDaemon.log 2>&1
+ *
+ * Commands are sent with FibreMonitorClient, which does not need ROOT:
+ * FibreMonitorSwitches.sh sends SYNC after reading the switches, and
+ * only runs the macro when the daemon is not there.
+ * CompareFibreMonitorDaemon.sh compares the time and CPU of both.
+ *
+ * Compile with:
+ *
+ *  g++ -O2 -o FibreMonitorDaemon FibreMonitorDaemon.cxx `root-config --cflags --libs`
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#include "TROOT.h"
+
+#include "FibreLogReader.h"
+#include "FibreMap.h"
+#include "FibreRing.h"
+#include "FibrePlot.h"
+#include "FibreMonitorSocket.h"
+
+#define MAX_WINDOWS 20
+#define MAX_CLIENTS 16
+#define MAX_COMMAND 4096
+#define CLIENT_TIMEOUT_S 30   // Clients that neither send nor take anything for this long are dropped
+#define LINE_BYTES 120        // More than the length of a log line
+#define NTIERS 2
+
+// As in PlotFibreMonSwitch.C
+static const char *tier_suffix[NTIERS] = {"hourly", "daily"};
+static int tier_seconds[NTIERS] = {3600, 86400};
+
+typedef struct {
+  int fd;                       // Non-blocking
+  char buffer[MAX_COMMAND + 1];
+  int len;
+  char *out;                    // Answers not sent yet
+  size_t out_len;
+  size_t out_sent;
+  int eof;                      // Nothing more to read: close once the answers are sent
+  time_t last_io;
+} Client;
+
+typedef struct {
+  const char *logfile;
+  FibreMapEntry *map;
+  int nfibres;
+
+  // Time slots, started with the first line read
+  FibreRing ring;
+  int ring_ready;
+  int capacity;
+  int step;
+  int time0;                    // First line of the log: slots start from it, x = 0 of the plots and tiers
+
+  // Tiers, updated as the slots close
+  FibreRollupTier tiers[NTIERS];
+  int use_tiers;
+  long closed;                  // Slots added to the tiers
+
+  // Lines being read, the hostname:port stay interned between reads
+  FibreLog data;
+  int *endpoint_tx;
+  int *endpoint_rx;
+  int nresolved;
+  long offset;
+  ino_t inode;
+  long rows;
+  int dirty;                    // Lines since the last drawing
+  time_t last_rows;             // When the last lines came, from the log or SAMPLE
+
+  // Plots
+  int windows[MAX_WINDOWS];
+  int nwindows;
+  int width, height;
+  TCanvas *canvas[FIBREROLLUP_METRICS];
+  unsigned int signature[FIBREROLLUP_METRICS][MAX_WINDOWS];   // Of the points last drawn
+  long drawn;
+  long skipped;
+
+  // Points of a window: x, and per fibre the value
+  double *px;
+  double *py;                   // [fibre][capacity]
+} Monitor;
+
+static volatile sig_atomic_t stop = 0;
+
+static void onSignal(int sig) {
+  stop = 1;
+}
+
+static double cpuSeconds() {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+
+  return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec)*1e-6;
+}
+
+static double realSeconds() {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+
+  return tv.tv_sec + tv.tv_usec*1e-6;
+}
+
+static void formatTime(int time, char *out, int outlen) {
+  int year, month, day, hour, minute;
+  fibreLogCivil(time, &year, &month, &day, &hour, &minute);
+  snprintf(out, outlen, "%04d.%02d.%02d %02d:%02d", year, month, day, hour, minute);
+}
+
+/*
+ * Offset of the first line in the last "bytes" bytes of the file.
+ */
+static long startOffset(const char *filename, long bytes) {
+  FILE *f = fopen(filename, "rb");
+  if (f == NULL) {
+    return 0;
+  }
+  fseek(f, 0, SEEK_END);
+  long size = ftell(f);
+  long offset = 0;
+  if (size > bytes) {
+    fseek(f, size - bytes, SEEK_SET);
+    int c;
+    while (((c = fgetc(f)) != EOF) && (c != '\n'));
+    offset = ftell(f);
+  }
+  fclose(f);
+
+  return offset;
+}
+
+/*
+ * Time of the first line of the log, 0 if there is none.
+ */
+static int firstLogTime(const char *filename) {
+  FILE *f = fopen(filename, "rb");
+  if (f == NULL) {
+    return 0;
+  }
+  FibreLog first;
+  memset(&first, 0, sizeof(first));
+  char line[1000];
+  for (int i = 0; (i < 100) && (first.nrows == 0) && (fgets(line, sizeof(line), f) != NULL); i++) {
+    fibreLogParseLine(&first, line, strcspn(line, "\r\n"));
+  }
+  fclose(f);
+  int time0 = (first.nrows > 0) ? first.time[0] : 0;
+  freeFibreLog(&first);
+
+  return time0;
+}
+
+/*
+ * Open the tiers of the log (emptied if reset is set). Without them, all
+ * the windows are drawn from the slots kept.
+ */
+static void openTiers(Monitor *mon, int reset) {
+  mon->use_tiers = 1;
+  for (int t = 0; t < NTIERS; t++) {
+    if (openFibreRollup(mon->logfile, tier_suffix[t], tier_seconds[t], mon->time0, mon->nfibres, reset, &mon->tiers[t]) < 0) {
+      fprintf(stderr, "Cannot write %s.%s\n", mon->logfile, tier_suffix[t]);
+      for (int u = 0; u < t; u++) {
+        closeFibreRollup(&mon->tiers[u]);
+      }
+      mon->use_tiers = 0;
+      return;
+    }
+  }
+}
+
+static void closeTiers(Monitor *mon) {
+  for (int t = 0; mon->use_tiers && (t < NTIERS); t++) {
+    closeFibreRollup(&mon->tiers[t]);
+  }
+  mon->use_tiers = 0;
+}
+
+/*
+ * Add a slot that is complete (a line of a later one came) to the tiers,
+ * as PlotFibreMonSwitch.C does. A slot already there is ignored by them.
+ */
+static void closeSlot(Monitor *mon, long slot) {
+  FibreRing *r = &mon->ring;
+  FibreValue value;
+  value.x = (float)(fibreRingTime(r, slot) - mon->time0);
+  for (int k = 0; mon->use_tiers && (k < mon->nfibres); k++) {
+    value.fibre_idx = k;
+    value.att = *fibreRingValue(r, 0, k, slot);
+    value.Ptx = *fibreRingValue(r, 1, k, slot);
+    value.Prx = *fibreRingValue(r, 2, k, slot);
+    value.temperature = *fibreRingValue(r, 3, k, slot);
+    for (int t = 0; t < NTIERS; t++) {
+      addFibreRollup(&mon->tiers[t], &value);
+    }
+  }
+  mon->closed++;
+}
+
+/*
+ * Attenuation of fibre k in a slot, compensating for the attenuators.
+ */
+static void updateAttenuation(Monitor *mon, int k, long slot) {
+  FibreRing *r = &mon->ring;
+  *fibreRingValue(r, 0, k, slot) = *fibreRingValue(r, 1, k, slot) - *fibreRingValue(r, 2, k, slot) - mon->map[k].attenuator;
+}
+
+/*
+ * Put the lines in mon->data into the time slots, and empty it.
+ */
+static void ingestRows(Monitor *mon) {
+  FibreLog *data = &mon->data;
+  FibreRing *r = &mon->ring;
+
+  // Fibres of the hostname:port not seen before
+  if (mon->nresolved < data->nendpoints) {
+    mon->endpoint_tx = (int*)realloc(mon->endpoint_tx, data->nendpoints*sizeof(int));
+    mon->endpoint_rx = (int*)realloc(mon->endpoint_rx, data->nendpoints*sizeof(int));
+    for (int e = mon->nresolved; e < data->nendpoints; e++) {
+      fibreMapFind(mon->map, mon->nfibres, data->endpoints[e].hostname, data->endpoints[e].port, &mon->endpoint_tx[e],
+                   &mon->endpoint_rx[e]);
+    }
+    mon->nresolved = data->nendpoints;
+  }
+
+  for (int pos = 0; pos < data->nrows; pos++) {
+    if (!mon->ring_ready) {
+      if (mon->time0 == 0) {   // A new log: new tiers too
+        mon->time0 = data->time[pos];
+        openTiers(mon, 1);
+      }
+      // Slots of PlotFibreMonSwitch.C, counted from the first line of the log
+      int time0 = data->time[pos] - (((data->time[pos] - mon->time0)%mon->step) + mon->step)%mon->step;
+      initFibreRing(r, mon->nfibres, mon->capacity, time0, mon->step);
+      mon->ring_ready = 1;
+    }
+    long slot = fibreRingSlot(r, data->time[pos]);
+    if ((r->last >= 0) && (slot > r->last)) {
+      closeSlot(mon, r->last);
+    }
+    if (!fibreRingOpen(r, slot)) {
+      continue;   // Older than what is kept
+    }
+    int tx = mon->endpoint_tx[data->endpoint[pos]];
+    int rx = mon->endpoint_rx[data->endpoint[pos]];
+    if (tx >= 0) {
+      *fibreRingValue(r, 1, tx, slot) = data->Ptx[pos];
+      *fibreRingValue(r, 3, tx, slot) = data->temp[pos];
+    }
+    if (rx >= 0) {
+      *fibreRingValue(r, 2, rx, slot) = data->Prx[pos];
+    }
+    if (tx >= 0) {
+      updateAttenuation(mon, tx, slot);
+    }
+    if ((rx >= 0) && (rx != tx)) {
+      updateAttenuation(mon, rx, slot);
+    }
+    mon->rows++;
+    mon->dirty = 1;
+  }
+  if (data->nrows > 0) {
+    mon->last_rows = time(NULL);
+  }
+  data->nrows = 0;
+  for (int t = 0; mon->use_tiers && (t < NTIERS); t++) {
+    flushFibreRollup(&mon->tiers[t]);   // For loadRollupGraphs()
+  }
+}
+
+/*
+ * Read the lines appended to the log since the last time. Returns the
+ * number of lines.
+ */
+static int followLog(Monitor *mon) {
+  struct stat st;
+  if (stat(mon->logfile, &st) != 0) {
+    return 0;
+  }
+  if ((st.st_ino != mon->inode) || (st.st_size < mon->offset)) {   // Rotated or truncated: start again, as the macro
+    mon->inode = st.st_ino;
+    mon->offset = 0;
+    if (mon->ring_ready) {
+      freeFibreRing(&mon->ring);
+      mon->ring_ready = 0;
+    }
+    closeTiers(mon);
+    mon->time0 = 0;
+  }
+  if (st.st_size == mon->offset) {
+    return 0;
+  }
+  int n = readFibreLogFrom(mon->logfile, mon->offset, 0, &mon->data);
+  if (n < 0) {
+    return 0;
+  }
+  mon->offset = mon->data.offset;
+  ingestRows(mon);
+
+  return n;
+}
+
+/*
+ * Points of the metric m over the last "hours" hours (all that is kept if
+ * 0), one per slot. x is in seconds from the first line of the log, at
+ * the end of the slot, as in PlotFibreMonSwitch.C. Returns the number of
+ * points, and the range of the values in *vmin and *vmax.
+ */
+static int windowPoints(Monitor *mon, int m, int hours, double *vmin, double *vmax) {
+  FibreRing *r = &mon->ring;
+  int cap = mon->capacity;
+  long oldest = fibreRingOldest(r);
+  long from = (hours > 0) ? r->last - (long)hours*3600/r->step + 1 : oldest;
+  if (from < oldest) {
+    from = oldest;
+  }
+  int n = 0;
+
+  *vmin = 1e30;
+  *vmax = -1e30;
+  for (long s = from; s <= r->last; s++) {
+    mon->px[n] = (double)(fibreRingTime(r, s) - mon->time0) + r->step;
+    for (int k = 0; k < mon->nfibres; k++) {
+      float v = *fibreRingValue(r, m, k, s);
+      mon->py[k*cap + n] = v;
+      if (v < *vmin) *vmin = v;
+      if (v > *vmax) *vmax = v;
+    }
+    n++;
+  }
+
+  return n;
+}
+
+static unsigned int windowSignature(const Monitor *mon, int hours, int n) {
+  unsigned int hash = fibreCheckpointHash(&hours, sizeof(hours), 0);
+  hash = fibreCheckpointHash(&n, sizeof(n), hash);
+  hash = fibreCheckpointHash(mon->px, n*sizeof(double), hash);
+  for (int k = 0; k < mon->nfibres; k++) {
+    hash = fibreCheckpointHash(mon->py + k*mon->capacity, n*sizeof(double), hash);
+  }
+
+  return hash;
+}
+
+/*
+ * Tier to draw a window from, as PlotFibreMonSwitch.C chooses it, or -1
+ * to draw it from the slots kept. "All data" longer than what is kept
+ * comes from the finest tier.
+ */
+static int windowTier(const Monitor *mon, int hours) {
+  const FibreRing *r = &mon->ring;
+  if (!mon->use_tiers) {
+    return -1;
+  }
+  long first = fibreRingSlot(r, mon->time0);
+  long slots = (hours > 0) ? (long)hours*3600/r->step : r->last - first + 1;
+  int tier = fibrePlotTier(slots, r->step, mon->width, tier_seconds, NTIERS);
+  if ((tier < 0) && (hours == 0) && (fibreRingOldest(r) > first)) {
+    tier = 0;
+  }
+
+  return tier;
+}
+
+/*
+ * Axes, ranges and name of a window, and save the PNG.
+ */
+static void printWindow(Monitor *mon, TGraph *frame, int m, int hours, double vmin, double vmax) {
+  // As in PlotFibreMonSwitch.C: x is the end of the slot, the labels show its start
+  frame->GetXaxis()->SetTimeOffset(mon->time0 - mon->step, "gmt");   // Log times are wall-clock times
+  fibrePlotYRange(frame, m, vmin, vmax);
+  fibrePlotZoom(frame, (double)(fibreRingTime(&mon->ring, mon->ring.last) - mon->time0) + mon->step, hours, mon->step);
+  char pngname[200];
+  fibrePlotName(pngname, sizeof(pngname), m, hours);
+  mon->canvas[m]->Print(pngname);
+}
+
+/*
+ * Draw the points of windowPoints() and save the PNG, as
+ * PlotFibreMonSwitch.C does (FibrePlot.h).
+ */
+static void drawWindow(Monitor *mon, int m, int hours, int n, double vmin, double vmax) {
+  TCanvas *can = mon->canvas[m];
+  int cap = mon->capacity;
+  TGraph **lines = (TGraph**)calloc(mon->nfibres, sizeof(TGraph*));
+  TLegend *legend = new TLegend(0.85, 0.85, 0.99, 0.99);
+
+  for (int k = 0; k < mon->nfibres; k++) {
+    lines[k] = new TGraph(n, mon->px, mon->py + k*cap);
+  }
+  fibrePlotStyle(lines, mon->nfibres);
+  for (int k = 0; k < mon->nfibres; k++) {
+    legend->AddEntry(lines[k], mon->map[k].fibrename, "LP");
+  }
+  TGraph *frame = drawFibreGraphs(can, lines, NULL, mon->nfibres, legend, fibrePlotYTitle[m], fibrePlotTitle[m]);
+  printWindow(mon, frame, m, hours, vmin, vmax);
+
+  // Free Willy
+  can->Clear();
+  for (int k = 0; k < mon->nfibres; k++) {
+    delete lines[k];
+  }
+  free(lines);
+  delete legend;
+}
+
+/*
+ * Draw a window from the graphs of a tier (loadRollupGraphs()). The Y
+ * range is that of the slots in the window, as in PlotFibreMonSwitch.C:
+ * from the slots kept, and the envelopes of the tier for the part of the
+ * window older than them.
+ */
+static void drawTierWindow(Monitor *mon, int m, int hours, TGraph **lines, TGraph **envelopes) {
+  TCanvas *can = mon->canvas[m];
+  FibreRing *r = &mon->ring;
+  TLegend *legend = new TLegend(0.85, 0.85, 0.99, 0.99);
+  double vmin, vmax;
+  windowPoints(mon, m, hours, &vmin, &vmax);
+  long from = (hours > 0) ? r->last - (long)hours*3600/r->step + 1 : fibreRingSlot(r, mon->time0);
+  double end = (double)(fibreRingTime(r, r->last) - mon->time0) + r->step;
+  double xmin = (from >= fibreRingOldest(r)) ? 1e30 : ((hours > 0) ? end - hours*3600.0 : -1e30);
+  for (int k = 0; k < mon->nfibres; k++) {
+    if (lines[k] == NULL) continue;
+    legend->AddEntry(lines[k], mon->map[k].fibrename, "LP");
+    for (int p = 0; p < envelopes[k]->GetN(); p++) {
+      if (envelopes[k]->GetX()[p] < xmin) continue;
+      double v = envelopes[k]->GetY()[p];
+      if (v < vmin) vmin = v;
+      if (v > vmax) vmax = v;
+    }
+  }
+  TGraph *frame = drawFibreGraphs(can, lines, envelopes, mon->nfibres, legend, fibrePlotYTitle[m], fibrePlotTitle[m]);
+  if (frame != NULL) {
+    printWindow(mon, frame, m, hours, vmin, vmax);
+  }
+
+  // Free Willy
+  can->Clear();
+  delete legend;
+}
+
+/*
+ * Draw the plots whose points changed since they were last drawn (all of
+ * them if force is set): for a window drawn from a tier, when a slot was
+ * added to the tiers. Returns the number drawn.
+ */
+static int renderPlots(Monitor *mon, int force) {
+  int drawn = 0;
+  mon->dirty = 0;
+  if (!mon->ring_ready) {
+    return 0;
+  }
+
+  // Graphs of the tiers, only loaded if needed
+  TGraph **tier_lines[NTIERS][FIBREROLLUP_METRICS];
+  TGraph **tier_envelopes[NTIERS][FIBREROLLUP_METRICS];
+  int tier_loaded[NTIERS] = {0};
+
+  for (int m = 0; m < FIBREROLLUP_METRICS; m++) {
+    for (int w = 0; w < mon->nwindows; w++) {
+      int hours = mon->windows[w];
+      int tier = windowTier(mon, hours);
+      unsigned int signature;
+      double vmin, vmax;
+      int n = 0;
+      if (tier >= 0) {
+        signature = fibreCheckpointHash(&hours, sizeof(hours), 0);
+        signature = fibreCheckpointHash(&tier, sizeof(tier), signature);
+        signature = fibreCheckpointHash(&mon->closed, sizeof(mon->closed), signature);
+        signature = fibreCheckpointHash(&mon->ring.last, sizeof(mon->ring.last), signature);
+      }
+      else {
+        n = windowPoints(mon, m, hours, &vmin, &vmax);
+        if (n == 0) {
+          continue;
+        }
+        signature = windowSignature(mon, hours, n);
+      }
+      if (!force && (signature == mon->signature[m][w])) {
+        mon->skipped++;
+        continue;
+      }
+      if (tier >= 0) {
+        if (!tier_loaded[tier]) {
+          tier_loaded[tier] = loadRollupGraphs(mon->logfile, tier_suffix[tier], tier_seconds[tier], mon->time0, mon->step,
+                                               mon->nfibres, tier_lines[tier], tier_envelopes[tier]) ? 1 : -1;
+        }
+        if (tier_loaded[tier] < 0) {
+          continue;   // Nothing in it yet
+        }
+        drawTierWindow(mon, m, hours, tier_lines[tier][m], tier_envelopes[tier][m]);
+      }
+      else {
+        drawWindow(mon, m, hours, n, vmin, vmax);
+      }
+      mon->signature[m][w] = signature;
+      mon->drawn++;
+      drawn++;
+    }
+  }
+
+  // Free Willy
+  for (int t = 0; t < NTIERS; t++) {
+    if (tier_loaded[t] > 0) {
+      freeRollupGraphs(mon->nfibres, tier_lines[t], tier_envelopes[t]);
+    }
+  }
+
+  return drawn;
+}
+
+/*
+ * A time of a QUERY: YYYY.MM.DD-HH:MM, "now", or -Nh / -Nd from now.
+ */
+static int parseQueryTime(const Monitor *mon, const char *token, int *time) {
+  int now = fibreRingTime(&mon->ring, mon->ring.last + 1);
+  int year, month, day, hour, minute;
+  char unit;
+  long n;
+  if (strcmp(token, "now") == 0) {
+    *time = now;
+    return 1;
+  }
+  if (sscanf(token, "-%ld%c", &n, &unit) == 2) {
+    *time = now - (int)n*((unit == 'd') ? 86400 : 3600);
+    return (unit == 'd') || (unit == 'h');
+  }
+  if (sscanf(token, "%d.%d.%d-%d:%d", &year, &month, &day, &hour, &minute) == 5) {
+    *time = fibreLogDaysFromCivil(year, month, day)*86400 + hour*3600 + minute*60;
+    return 1;
+  }
+
+  return 0;
+}
+
+static void commandQuery(Monitor *mon, const char *args, FILE *out) {
+  char from_token[100], to_token[100], fibre_token[100] = "all";
+  int from, to;
+  if ((sscanf(args, "%99s %99s %99s", from_token, to_token, fibre_token) < 2) || !mon->ring_ready ||
+      !parseQueryTime(mon, from_token, &from) || !parseQueryTime(mon, to_token, &to)) {
+    fprintf(out, "ERR use QUERY <from> <to> [fibre], times as YYYY.MM.DD-HH:MM, now, -Nh or -Nd\n");
+    return;
+  }
+  int fibre = -1;
+  if (strcmp(fibre_token, "all") != 0) {
+    for (int k = 0; k < mon->nfibres; k++) {
+      if ((strcmp(mon->map[k].fibrename, fibre_token) == 0) || (mon->map[k].fibre == atoi(fibre_token))) {
+        fibre = k;
+      }
+    }
+    if (fibre < 0) {
+      fprintf(out, "ERR no fibre %s\n", fibre_token);
+      return;
+    }
+  }
+
+  FibreRing *r = &mon->ring;
+  long first = fibreRingSlot(r, from);
+  long last = fibreRingSlot(r, to);
+  if (first < fibreRingOldest(r)) first = fibreRingOldest(r);
+  if (last > r->last) last = r->last;
+  long n = 0;
+  char date[100];
+  for (long s = first; s <= last; s++) {
+    formatTime(fibreRingTime(r, s), date, sizeof(date));
+    for (int k = 0; k < mon->nfibres; k++) {
+      if ((fibre >= 0) && (k != fibre)) continue;
+      fprintf(out, "%s\t%s\t%.2f\t%.2f\t%.2f\t%.2f\n", date, mon->map[k].fibrename, *fibreRingValue(r, 0, k, s),
+              *fibreRingValue(r, 1, k, s), *fibreRingValue(r, 2, k, s), *fibreRingValue(r, 3, k, s));
+      n++;
+    }
+  }
+  fprintf(out, "OK %ld values\n", n);
+}
+
+static void commandStatus(Monitor *mon, FILE *out) {
+  char first[100] = "-", last[100] = "-";
+  long nslots = 0;
+  if (mon->ring_ready && (mon->ring.last >= 0)) {
+    formatTime(fibreRingTime(&mon->ring, fibreRingOldest(&mon->ring)), first, sizeof(first));
+    formatTime(fibreRingTime(&mon->ring, mon->ring.last), last, sizeof(last));
+    nslots = mon->ring.last - fibreRingOldest(&mon->ring) + 1;
+  }
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  fprintf(out, "OK fibres=%d slots=%ld first=\"%s\" last=\"%s\" rows=%ld drawn=%ld skipped=%ld cpu_s=%.3f peak_rss_kb=%ld\n",
+          mon->nfibres, nslots, first, last, mon->rows, mon->drawn, mon->skipped, cpuSeconds(), usage.ru_maxrss);
+}
+
+/*
+ * Run one command line and write its answer to out.
+ */
+static void runCommand(Monitor *mon, char *line, FILE *out) {
+  char *args = line;
+  while ((*args != '\0') && (*args != ' ') && (*args != '\t')) args++;
+  if (*args != '\0') {
+    *args++ = '\0';
+  }
+
+  if (strcmp(line, "SAMPLE") == 0) {
+    if (fibreLogParseLine(&mon->data, args, strlen(args))) {
+      ingestRows(mon);
+      fprintf(out, "OK\n");
+    }
+    else {
+      fprintf(out, "ERR not a log line\n");
+    }
+  }
+  else if ((strcmp(line, "SYNC") == 0) || (strcmp(line, "RENDER") == 0)) {
+    double cpu = cpuSeconds();
+    int rows = followLog(mon);
+    long before = mon->skipped;
+    int drawn = renderPlots(mon, strcmp(line, "RENDER") == 0);
+    fprintf(out, "OK %d rows, %d plots drawn, %ld unchanged, %.3f s CPU\n", rows, drawn, mon->skipped - before,
+            cpuSeconds() - cpu);
+  }
+  else if (strcmp(line, "QUERY") == 0) {
+    commandQuery(mon, args, out);
+  }
+  else if (strcmp(line, "STATUS") == 0) {
+    commandStatus(mon, out);
+  }
+  else {
+    fprintf(out, "ERR unknown command %s\n", line);
+  }
+}
+
+/*
+ * Run the complete lines the client sent. At the end of the input (eof),
+ * run what is left too. The answers are kept in the client, to be sent
+ * when the socket takes them (sendClient()), so a client that does not
+ * read them does not stop the daemon.
+ */
+static void serveClient(Monitor *mon, Client *c, int eof) {
+  char *text = NULL;
+  size_t size = 0;
+  FILE *out = open_memstream(&text, &size);
+  if (out == NULL) {
+    return;
+  }
+  int start = 0;
+  for (int i = 0; i < c->len; i++) {
+    if (c->buffer[i] == '\n') {
+      c->buffer[i] = '\0';
+      if ((i > start) && (c->buffer[i - 1] == '\r')) c->buffer[i - 1] = '\0';
+      if (c->buffer[start] != '\0') runCommand(mon, c->buffer + start, out);
+      start = i + 1;
+    }
+  }
+  if (eof && (start < c->len)) {
+    c->buffer[c->len] = '\0';
+    runCommand(mon, c->buffer + start, out);
+    start = c->len;
+  }
+  if ((start == 0) && (c->len == MAX_COMMAND)) {   // Line too long: drop it
+    fprintf(out, "ERR line too long\n");
+    start = c->len;
+  }
+  memmove(c->buffer, c->buffer + start, c->len - start);
+  c->len -= start;
+  c->eof = eof;
+  fclose(out);
+
+  if (size > 0) {
+    c->out = (char*)realloc(c->out, c->out_len + size);
+    memcpy(c->out + c->out_len, text, size);
+    c->out_len += size;
+  }
+  free(text);
+}
+
+/*
+ * Send what the socket takes of the answers. Returns -1 if the client is
+ * gone.
+ */
+static int sendClient(Client *c) {
+  while (c->out_sent < c->out_len) {
+    ssize_t sent = write(c->fd, c->out + c->out_sent, c->out_len - c->out_sent);
+    if (sent < 0) {
+      return ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR)) ? 0 : -1;
+    }
+    c->out_sent += sent;
+    c->last_io = time(NULL);
+  }
+  free(c->out);
+  c->out = NULL;
+  c->out_len = 0;
+  c->out_sent = 0;
+
+  return 0;
+}
+
+static int listenSocket(const char *path) {
+  struct sockaddr_un addr;
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "Socket name too long: %s\n", path);
+    return -1;
+  }
+  int fd = connectFibreMonitor(path);
+  if (fd >= 0) {
+    fprintf(stderr, "There is a daemon already at %s\n", path);
+    close(fd);
+    return -1;
+  }
+  unlink(path);   // Left by one that died
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, path);
+  fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if ((fd < 0) || (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) || (listen(fd, MAX_CLIENTS) != 0)) {
+    fprintf(stderr, "Cannot listen at %s: %s\n", path, strerror(errno));
+    return -1;
+  }
+
+  return fd;
+}
+
+int main(int argc, char **argv) {
+  const char *logname = "MergedLog.txt";
+  const char *mapname = "fibremap.txt";
+  const char *sockname = FIBREMONITOR_SOCKET;
+  const char *window_list = "0,24,12";
+  int days = 30;
+  int interval = 10;
+  int width = 1400, height = 900;
+  int follow_s = 5;
+  int quiet_s = 30;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "l:m:S:d:i:w:W:H:f:q:")) != -1) {
+    switch (opt) {
+      case 'l': logname = optarg; break;
+      case 'm': mapname = optarg; break;
+      case 'S': sockname = optarg; break;
+      case 'd': days = atoi(optarg); break;
+      case 'i': interval = atoi(optarg); break;
+      case 'w': window_list = optarg; break;
+      case 'W': width = atoi(optarg); break;
+      case 'H': height = atoi(optarg); break;
+      case 'f': follow_s = atoi(optarg); break;
+      case 'q': quiet_s = atoi(optarg); break;
+      default:
+        fprintf(stderr, "Use: %s [-l log] [-m fibremap] [-S socket] [-d days] [-i minutes] [-w windows] [-W width] [-H height] "
+                        "[-f seconds] [-q seconds]\n", argv[0]);
+        return 1;
+    }
+  }
+  if ((days <= 0) || (interval <= 0) || (width <= 0) || (height <= 0) || (follow_s <= 0)) {
+    fprintf(stderr, "Wrong options\n");
+    return 1;
+  }
+
+  double start_real = realSeconds();
+  Monitor mon;
+  memset(&mon, 0, sizeof(mon));
+  mon.logfile = logname;
+  mon.nfibres = readFibreMap(mapname, &mon.map);
+  if (mon.nfibres <= 0) {
+    fprintf(stderr, "No fibres in %s\n", mapname);
+    return 1;
+  }
+  mon.step = interval*60;
+  mon.capacity = days*86400/mon.step;
+  mon.nwindows = parseWindows(window_list, mon.windows, MAX_WINDOWS);
+  mon.width = width;
+  mon.height = height;
+  mon.px = (double*)malloc(mon.capacity*sizeof(double));
+  mon.py = (double*)malloc((size_t)mon.nfibres*mon.capacity*sizeof(double));
+
+  int listen_fd = listenSocket(sockname);
+  if (listen_fd < 0) {
+    return 1;
+  }
+
+  // Only the end of the log is needed (about a line per fibre and slot),
+  // unless the tiers are still to be filled
+  struct stat st;
+  if (stat(logname, &st) == 0) {
+    mon.inode = st.st_ino;
+  }
+  mon.time0 = firstLogTime(logname);
+  if (mon.time0 != 0) {
+    char tiername[1000];
+    snprintf(tiername, sizeof(tiername), "%s.%s", logname, tier_suffix[0]);
+    int empty = (stat(tiername, &st) != 0) || (st.st_size == 0);
+    openTiers(&mon, empty);
+    mon.offset = empty ? 0 : startOffset(logname, (long)mon.capacity*2*mon.nfibres*LINE_BYTES);
+  }
+  followLog(&mon);
+
+  gROOT->SetBatch(kTRUE);
+  for (int m = 0; m < FIBREROLLUP_METRICS; m++) {
+    mon.canvas[m] = new TCanvas(fibrePlotCanvas[m], fibrePlotCanvasTitle[m], width, height);
+  }
+  renderPlots(&mon, 1);
+  char date[100];
+  time_t now = time(NULL);
+  strftime(date, sizeof(date), "%Y.%m.%d %H:%M:%S", localtime(&now));
+  printf("%s\tready\tfibres=%d\trows=%ld\tdrawn=%ld\treal_s=%.3f\tcpu_s=%.3f\n", date, mon.nfibres, mon.rows, mon.drawn,
+         realSeconds() - start_real, cpuSeconds());
+  fflush(stdout);
+
+  signal(SIGINT, onSignal);
+  signal(SIGTERM, onSignal);
+  signal(SIGPIPE, SIG_IGN);
+
+  Client clients[MAX_CLIENTS];
+  int nclients = 0;
+  time_t last_follow = time(NULL);
+  while (!stop) {
+    struct pollfd fds[1 + MAX_CLIENTS];
+    fds[0].fd = listen_fd;
+    fds[0].events = (nclients < MAX_CLIENTS) ? POLLIN : 0;
+    for (int i = 0; i < nclients; i++) {
+      // No more commands from a client until it has taken its answers
+      fds[1 + i].fd = clients[i].fd;
+      fds[1 + i].events = (clients[i].out_len > 0) ? POLLOUT : (clients[i].eof ? 0 : POLLIN);
+      fds[1 + i].revents = 0;
+    }
+    if ((poll(fds, 1 + nclients, 1000) < 0) && (errno != EINTR)) {
+      break;
+    }
+
+    // Clients: each line is a command, the answer goes back when the client takes it
+    now = time(NULL);
+    for (int i = nclients - 1; i >= 0; i--) {
+      Client *c = &clients[i];
+      int gone = 0;
+      if (fds[1 + i].revents & POLLIN) {
+        ssize_t got = read(c->fd, c->buffer + c->len, MAX_COMMAND - c->len);
+        if ((got < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR))) {
+          got = 0;
+        }
+        else {
+          if (got > 0) {
+            c->len += got;
+            c->last_io = now;
+          }
+          serveClient(&mon, c, got <= 0);
+        }
+      }
+      else if (fds[1 + i].revents & (POLLHUP | POLLERR)) {
+        gone = (c->out_len > 0) || !c->eof;
+        if (!gone) serveClient(&mon, c, 1);
+      }
+      if (!gone && (c->out_len > 0)) {
+        gone = (sendClient(c) < 0);
+      }
+      if (gone || (c->eof && (c->out_len == 0)) || (now - c->last_io > CLIENT_TIMEOUT_S)) {
+        close(c->fd);
+        free(c->out);
+        clients[i] = clients[--nclients];
+      }
+    }
+    if (fds[0].revents & POLLIN) {
+      int fd = accept(listen_fd, NULL, NULL);
+      if (fd >= 0) {
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        memset(&clients[nclients], 0, sizeof(Client));
+        clients[nclients].fd = fd;
+        clients[nclients].last_io = now;
+        nclients++;
+      }
+    }
+
+    // The log, and the plots once it has been quiet for a while
+    now = time(NULL);
+    if (now - last_follow >= follow_s) {
+      followLog(&mon);
+      last_follow = now;
+    }
+    if (mon.dirty && (now - mon.last_rows >= quiet_s)) {
+      double cpu = cpuSeconds();
+      long skipped = mon.skipped;
+      int drawn = renderPlots(&mon, 0);
+      strftime(date, sizeof(date), "%Y.%m.%d %H:%M:%S", localtime(&now));
+      printf("%s\tdrawn=%d\tunchanged=%ld\trows=%ld\tcpu_s=%.3f\n", date, drawn, mon.skipped - skipped, mon.rows,
+             cpuSeconds() - cpu);
+      fflush(stdout);
+    }
+  }
+
+  // Free Willy
+  for (int i = 0; i < nclients; i++) {
+    close(clients[i].fd);
+    free(clients[i].out);
+  }
+  close(listen_fd);
+  unlink(sockname);
+  for (int m = 0; m < FIBREROLLUP_METRICS; m++) {
+    delete mon.canvas[m];
+  }
+  closeTiers(&mon);
+  freeFibreRing(&mon.ring);
+  freeFibreLog(&mon.data);
+  free(mon.endpoint_tx);
+  free(mon.endpoint_rx);
+  free(mon.map);
+  free(mon.px);
+  free(mon.py);
+
+  return 0;
+}
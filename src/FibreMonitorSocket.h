@@ -0,0 +1,111 @@
+/*
+ * FibreMonitorSocket.h
+ *
+ * The Unix socket of FibreMonitorDaemon, for the daemon and for
+ * FibreMonitorClient (which must not need ROOT): a command is a line, the
+ * answer ends with a line "OK ..." or "ERR ...".
+ */
+#ifndef FIBREMONITORSOCKET_H
+#define FIBREMONITORSOCKET_H
+
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#define FIBREMONITOR_SOCKET "FibreMonitor.sock"
+
+/*
+ * Connect to the daemon at path. Returns the socket, -1 if there is none.
+ */
+static int connectFibreMonitor(const char *path) {
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if ((fd >= 0) && (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0)) {
+    close(fd);
+    fd = -1;
+  }
+
+  return fd;
+}
+
+static long fibreMonitorMs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec*1000L + ts.tv_nsec/1000000;
+}
+
+/*
+ * Send one command to the daemon at path and copy the answer to out,
+ * waiting for all of it at most timeout_s seconds (0 for ever), however
+ * slowly it comes. Returns 0 if the answer is OK, 1 if it is ERR, there
+ * is no daemon or it timed out.
+ */
+static int sendFibreMonitorCommand(const char *path, const char *command, int timeout_s, FILE *out) {
+  int fd = connectFibreMonitor(path);
+  if (fd < 0) {
+    fprintf(stderr, "No daemon at %s\n", path);
+    return 1;
+  }
+  long deadline = fibreMonitorMs() + timeout_s*1000L;
+  if (timeout_s > 0) {
+    struct timeval tv = {timeout_s, 0};
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+  }
+  if ((write(fd, command, strlen(command)) < 0) || (write(fd, "\n", 1) < 0)) {
+    close(fd);
+    return 1;
+  }
+  shutdown(fd, SHUT_WR);
+
+  char buffer[4096];
+  char last[5] = "";            // Start of the last line
+  int col = 0;
+  ssize_t got;
+  while (1) {
+    if (timeout_s > 0) {
+      // A timeout per read would let an answer that trickles in go on for ever
+      long left = deadline - fibreMonitorMs();
+      struct pollfd pfd = {fd, POLLIN, 0};
+      int ready = (left > 0) ? poll(&pfd, 1, left) : 0;
+      if ((ready < 0) && (errno == EINTR)) {
+        continue;
+      }
+      if (ready <= 0) {
+        got = -1;
+        break;
+      }
+    }
+    if ((got = read(fd, buffer, sizeof(buffer))) <= 0) {
+      break;
+    }
+    fwrite(buffer, 1, got, out);
+    for (ssize_t i = 0; i < got; i++) {
+      if (buffer[i] == '\n') {
+        col = 0;
+      }
+      else if (col < 4) {
+        last[col++] = buffer[i];
+        last[col] = '\0';
+      }
+    }
+  }
+  close(fd);
+  if (got < 0) {
+    fprintf(stderr, "No answer from the daemon at %s\n", path);
+    return 1;
+  }
+
+  return (strncmp(last, "OK", 2) == 0) ? 0 : 1;
+}
+
+#endif
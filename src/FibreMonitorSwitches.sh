@@ -13,10 +13,28 @@
 #              in all SFP columns. Fixed by repeating the read-out until it 
 #              stops doing it.
 #  01/07/2014: fixed infinite loop problem spotted overnight. Maximum of 20 tries.
+#  17/10/2026: also append the readings to the binary store (FibreStore.h) if
+#              FibreStoreAppend has been compiled.
+#  17/10/2026: use SwitchPoller, if compiled, to read all the switches at the
+#              same time. Its per-switch report goes to SwitchPoller.log.
+#  17/10/2026: SwitchPoller parses the answers itself (SfpParser.h), so
+#              ProcessData.sh, temp.txt and SwitchLog.txt are only used
+#              by the loop below, when SwitchPoller is not there.
+#  17/10/2026: SwitchPoller looks for attenuation steps, drift and stale
+#              ports (FibreAnomaly.h), alerts in FibreAlerts.log.
+#  17/10/2026: if FibreMonitorDaemon is running, it draws the plots (SYNC)
+#              instead of starting ROOT and the macro every cycle.
+#  17/10/2026: SwitchPoller is started once and left running (-i), so the
+#              sessions stay open between cycles; from cron this script
+#              only restarts it if it died. It reads the password from
+#              SwitchPassword.txt (chmod 600) or SWITCH_PASSWORD.
+#  17/10/2026: SYNC is sent with FibreMonitorClient, which does not load
+#              ROOT.
 #    
 
 
 nswitches=3	# change this, not the array
+interval=600	# seconds between read-outs with SwitchPoller (same as the crontab)
 
 cd /home/pi/SwitchReading
 
@@ -30,6 +48,45 @@ switch[5]='192.168.1.6'
 switch[6]='192.168.1.7'
 switch[7]='192.168.1.8'
 
+# Generate png files: by the daemon if it is running, else using ROOT
+plot() {
+	if ! ( [ -S FibreMonitor.sock ] && ./FibreMonitorClient SYNC > /dev/null )
+	then
+		root -b -q "PlotFibreMonSwitch.C(-1)"
+	fi
+}
+
+# SwitchPoller runs this after each of its cycles
+if [ "$1" == "plot" ]
+then
+	plot
+	exit 0
+fi
+
+# SwitchPoller stays running, keeps the sessions to the switches open
+# between cycles and plots after each one. From cron, this only starts
+# it again if it is not running (e.g. after a reboot).
+if [ -x ./SwitchPoller ]
+then
+	if [ -f SwitchPoller.pid ] && [ "$(cat /proc/$(cat SwitchPoller.pid)/comm 2> /dev/null)" == "SwitchPoller" ]
+	then
+		exit 0
+	fi
+	store=""
+	if [ -x ./FibreStoreAppend ]
+	then
+		store="-s FibreStore"
+	fi
+	if [ -f fibremap.txt ]
+	then
+		store="$store -m fibremap.txt"
+	fi
+	nohup ./SwitchPoller -i $interval -x "./FibreMonitorSwitches.sh plot" $store "${switch[@]:0:$nswitches}" \
+		>> SwitchPoller.log 2>&1 < /dev/null &
+	echo $! > SwitchPoller.pid
+	exit 0
+fi
+
 for((i=0;i<$nswitches;i++)) do
 	thisisfine=0
 	count=0
@@ -52,10 +109,12 @@ for((i=0;i<$nswitches;i++)) do
 	if [ $thisisfine -gt 0 ]
 	then
 		cat SwitchLog.txt >> MergedLog.txt
+		if [ -x ./FibreStoreAppend ]
+		then
+			./FibreStoreAppend FibreStore SwitchLog.txt > /dev/null
+		fi
 	fi
 	rm SwitchLog.txt
 done
 
-# Generate png files using ROOT
-root -b -q "PlotFibreMonSwitch.C(-1)"
-
+plot
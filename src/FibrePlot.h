@@ -0,0 +1,241 @@
+/*
+ * FibrePlot.h
+ *
+ * Drawing of the fibre plots, shared by PlotFibreMonSwitch.C and the
+ * programs that do the same plots (BenchFibrePipeline.C,
+ * FibreMonitorDaemon): the list of windows, the names of the plots, the
+ * graphs of the tiers of FibreRollup.h, the choice of a tier for a window
+ * with more time slots than pixels, and the drawing of the graphs of one
+ * metric with their axes, ranges and legend.
+ */
+#ifndef FIBREPLOT_H
+#define FIBREPLOT_H
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "TCanvas.h"
+#include "TGraph.h"
+#include "TLegend.h"
+#include "TAxis.h"
+
+#include "FibreRollup.h"
+
+// Per metric, in FibreRollup.h order
+static const char *fibrePlotFile[FIBREROLLUP_METRICS] = {"attenuation", "txpower", "rxpower", "temperature"};
+static const char *fibrePlotCanvas[FIBREROLLUP_METRICS] = {"C_att", "TxPower", "RxPower", "Temperature"};
+static const char *fibrePlotCanvasTitle[FIBREROLLUP_METRICS] = {"Attenuation", "TxPower", "RxPower", "Temperature"};
+static const char *fibrePlotYTitle[FIBREROLLUP_METRICS] = {"Attenuation [dB]", "TxPower [dBm]", "RxPower [dBm]", "Temperature [^{o}C]"};
+static const char *fibrePlotTitle[FIBREROLLUP_METRICS] = {"Fibres attenuation", "SFP Transmitted Power", "SFP Received Power", "SFP Temperature"};
+
+/*
+ * Read a list of plot windows like "0,24,12" or "1,6,24,7d,30d": hours,
+ * or days with a "d", 0 for all data. Returns the number of windows.
+ */
+static int parseWindows(const char *list, int *windows, int max) {
+  int n = 0;
+  const char *p = list;
+  while ((*p != '\0') && (n < max)) {
+    char *end;
+    long value = strtol(p, &end, 10);
+    if (end == p) {
+      break;
+    }
+    if ((*end == 'd') || (*end == 'D')) {
+      value *= 24;
+      end++;
+    }
+    windows[n++] = value;
+    p = end;
+    while ((*p == ',') || (*p == ' ')) p++;
+  }
+  if (n == 0) {
+    windows[n++] = 0;
+  }
+
+  return n;
+}
+
+/*
+ * PNG of metric m for a window of "hours" hours (0 for all data).
+ */
+static void fibrePlotName(char *name, int len, int m, int hours) {
+  if (hours > 0) {
+    snprintf(name, len, "%s_%d_hours.png", fibrePlotFile[m], hours);
+  }
+  else {
+    snprintf(name, len, "%s.png", fibrePlotFile[m]);
+  }
+}
+
+/*
+ * Tier to draw "slots" time slots of "step" seconds on "width" pixels:
+ * the first one (tiers from the finest) with no more buckets than pixels,
+ * else the last one. -1 if the slots fit as they are.
+ */
+static int fibrePlotTier(int slots, int step, int width, const int *tier_seconds, int ntiers) {
+  if (slots <= width) {
+    return -1;
+  }
+  int tier = ntiers - 1;
+  for (int t = ntiers - 1; t >= 0; t--) {
+    if ((long)slots*step/tier_seconds[t] <= width) {
+      tier = t;
+    }
+  }
+
+  return tier;
+}
+
+/*
+ * Colour and width of the line of each fibre. Every set of graphs of a
+ * metric (time slots and tiers) gets them when it is built, before any
+ * legend entry is made from it (an entry copies the line style), so the
+ * legend matches whichever set is drawn.
+ */
+static void fibrePlotStyle(TGraph **lines, int nfibres) {
+  for (int i = 0; i < nfibres; i++) {
+    if (lines[i] == NULL) continue;
+    lines[i]->SetLineColor(i + 1);
+    lines[i]->SetLineWidth(2);
+  }
+}
+
+/*
+ * Free what loadRollupGraphs() allocated for one tier.
+ */
+static void freeRollupGraphs(int nfibres, TGraph ***lines, TGraph ***envelopes) {
+  for (int m = 0; m < FIBREROLLUP_METRICS; m++) {
+    for (int k = 0; k < nfibres; k++) {
+      delete lines[m][k];
+      delete envelopes[m][k];
+    }
+    free(lines[m]);
+    free(envelopes[m]);
+  }
+}
+
+/*
+ * Build the graphs of one tier of FibreRollup.h: for each metric and fibre,
+ * a line with the mean of each bucket and a polygon with the min/max
+ * envelope. Fibres with no buckets in the tier (e.g. just added to the
+ * map) are left NULL. step is the seconds of a time slot, for the x
+ * reference. Returns 0 if the tier is empty.
+ */
+static int loadRollupGraphs(const char *logfile, const char *suffix, int seconds, int time0, int step, int nfibres,
+                            TGraph ***lines, TGraph ***envelopes) {
+  FibreRollup *rollups;
+  long nbuckets = readFibreRollup(logfile, suffix, nfibres, &rollups);
+  if (nbuckets == 0) {
+    return 0;
+  }
+  int align = ((time0%seconds) + seconds)%seconds;
+  int nonempty = 0;
+
+  for (int m = 0; m < FIBREROLLUP_METRICS; m++) {
+    lines[m] = (TGraph**)calloc(nfibres, sizeof(TGraph*));
+    envelopes[m] = (TGraph**)calloc(nfibres, sizeof(TGraph*));
+    for (int k = 0; k < nfibres; k++) {
+      int n = 0;
+      for (long b = 0; b < nbuckets; b++) {
+        if (rollups[b*nfibres + k].n > 0) n++;
+      }
+      if (n == 0) {
+        continue;
+      }
+      nonempty++;
+      lines[m][k] = new TGraph(n);
+      envelopes[m][k] = new TGraph(2*n);
+      int p = 0;
+      for (long b = 0; b < nbuckets; b++) {
+        FibreRollup *r = &rollups[b*nfibres + k];
+        if (r->n == 0) continue;
+        // Same x reference as the time slots, at the middle of the bucket
+        double x = b*seconds - align + seconds/2 + step;
+        lines[m][k]->SetPoint(p, x, r->sum[m]/r->n);
+        envelopes[m][k]->SetPoint(p, x, r->max[m]);
+        envelopes[m][k]->SetPoint(2*n - 1 - p, x, r->min[m]);
+        p++;
+      }
+    }
+    fibrePlotStyle(lines[m], nfibres);
+  }
+  free(rollups);
+  if (nonempty == 0) {
+    freeRollupGraphs(nfibres, lines, envelopes);
+    return 0;
+  }
+
+  return 1;
+}
+
+/*
+ * Draw the graphs of one metric for all the fibres, with their min/max
+ * envelopes if there are any. Fibres without a graph are left out.
+ * Returns the graph that holds the axes.
+ */
+static TGraph *drawFibreGraphs(TCanvas *can, TGraph **lines, TGraph **envelopes, int nfibres, TLegend *legend,
+                               const char *ytitle, const char *title) {
+  TGraph *frame = NULL;
+  fibrePlotStyle(lines, nfibres);
+  can->Clear();
+  can->cd();
+  for (int i = 0; i < nfibres; i++) {
+    if (lines[i] == NULL) continue;
+    lines[i]->Draw(frame == NULL ? "AL" : "L,same");
+    if (frame == NULL) frame = lines[i];
+  }
+  if (frame == NULL) {
+    return NULL;
+  }
+  if (envelopes != NULL) {
+    for (int i = 0; i < nfibres; i++) {
+      if (envelopes[i] == NULL) continue;
+      envelopes[i]->SetFillColorAlpha(i + 1, 0.3);
+      envelopes[i]->SetLineWidth(0);
+      envelopes[i]->Draw("F,same");
+    }
+    for (int i = 0; i < nfibres; i++) {
+      if (lines[i] != NULL) lines[i]->Draw("L,same");
+    }
+  }
+  frame->GetYaxis()->SetTitle(ytitle);
+  frame->GetXaxis()->SetTitle("");
+  frame->SetTitle(title);
+  frame->GetXaxis()->SetTimeFormat("#splitline{%d/%m}{%H:%M}");
+  frame->GetXaxis()->SetTimeDisplay(1);
+  frame->GetXaxis()->SetLabelOffset(0.03);
+
+  legend->Draw();
+
+  return frame;
+}
+
+/*
+ * Y range of metric m for values from vmin to vmax.
+ */
+static void fibrePlotYRange(TGraph *frame, int m, double vmin, double vmax) {
+  if (m == 0) {
+    frame->GetYaxis()->SetRangeUser(floor(vmin*.95), ceil(vmax*1.05));
+  }
+  else {
+    frame->GetYaxis()->SetRangeUser((ceil(vmin) - 1), (floor(vmax) + 1));
+  }
+}
+
+/*
+ * Zoom in on the last "hours" hours before "end" (x of the end of the last
+ * slot), with slots of "step" seconds. The space after the end, for the
+ * legend, depends on the number of hours. With 0 hours, show the whole
+ * graph: the same graph may have been zoomed in for a previous window.
+ */
+static void fibrePlotZoom(TGraph *frame, double end, int hours, int step) {
+  if (hours <= 0) {
+    frame->GetXaxis()->UnZoom();
+    return;
+  }
+  frame->GetXaxis()->SetRangeUser(end - hours*3600, end + step*(5*hours/12));
+}
+
+#endif
@@ -0,0 +1,113 @@
+/*
+ * FibreRing.h
+ *
+ * The last N time slots of every fibre, for programs that keep running
+ * (FibreMonitorDaemon): a fixed-size ring per fibre and metric
+ * (attenuation, Ptx, Prx, temperature, same order as FibreRollup.h), so
+ * the memory used does not grow with the log.
+ *
+ * Slot s covers the seconds [time0 + s*step, time0 + (s + 1)*step) and is
+ * kept at s % capacity. Slots are counted from time0 for ever, so that
+ * a slot number always means the same time. A new slot starts with the
+ * values of the previous one (as the "fix null values" loop of
+ * PlotFibreMonSwitch.C did), so fibres that were not read in a cycle
+ * keep their last value; the same is done for the slots of a gap.
+ */
+#ifndef FIBRERING_H
+#define FIBRERING_H
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "FibreRollup.h"
+
+typedef struct {
+  int nfibres;
+  int capacity;                 // Slots kept
+  int time0;                    // Start of slot 0
+  int step;                     // Seconds per slot
+  long first;                   // First slot ever opened, -1 if none
+  long last;                    // Last slot opened, -1 if none
+  float *buffer;                // [metric][fibre][capacity]
+} FibreRing;
+
+static void initFibreRing(FibreRing *r, int nfibres, int capacity, int time0, int step) {
+  memset(r, 0, sizeof(FibreRing));
+  r->nfibres = nfibres;
+  r->capacity = capacity;
+  r->time0 = time0;
+  r->step = step;
+  r->first = -1;
+  r->last = -1;
+  r->buffer = (float*)calloc((size_t)FIBREROLLUP_METRICS*nfibres*capacity, sizeof(float));
+}
+
+/*
+ * Slot of a time (the seconds of FibreLogReader.h).
+ */
+static inline long fibreRingSlot(const FibreRing *r, int time) {
+  long d = (long)time - r->time0;
+  return (d >= 0) ? d/r->step : -((-d + r->step - 1)/r->step);
+}
+
+static inline int fibreRingTime(const FibreRing *r, long slot) {
+  return r->time0 + (int)(slot*r->step);
+}
+
+/*
+ * Oldest slot still kept, or -1 if there are none.
+ */
+static inline long fibreRingOldest(const FibreRing *r) {
+  if (r->last < 0) {
+    return -1;
+  }
+  long oldest = r->last - r->capacity + 1;
+
+  return (oldest > r->first) ? oldest : r->first;
+}
+
+static inline float *fibreRingValue(FibreRing *r, int m, int k, long slot) {
+  return r->buffer + ((size_t)m*r->nfibres + k)*r->capacity + slot%r->capacity;
+}
+
+/*
+ * Open the slots up to "slot", copying the values of the last one into
+ * them. Returns 0 if "slot" is too old to be kept.
+ */
+static int fibreRingOpen(FibreRing *r, long slot) {
+  if (slot < 0) {
+    return 0;
+  }
+  if (r->last < 0) {
+    r->first = slot;
+    r->last = slot;
+    return 1;
+  }
+  if (slot <= r->last) {
+    return slot >= fibreRingOldest(r);
+  }
+
+  // A gap longer than the ring: only the last "capacity" slots matter
+  long from = r->last + 1;
+  if (slot - from >= r->capacity) {
+    from = slot - r->capacity + 1;
+  }
+  for (int m = 0; m < FIBREROLLUP_METRICS; m++) {
+    for (int k = 0; k < r->nfibres; k++) {
+      float previous = *fibreRingValue(r, m, k, r->last);
+      for (long s = from; s <= slot; s++) {
+        *fibreRingValue(r, m, k, s) = previous;
+      }
+    }
+  }
+  r->last = slot;
+
+  return 1;
+}
+
+static void freeFibreRing(FibreRing *r) {
+  free(r->buffer);
+  memset(r, 0, sizeof(FibreRing));
+}
+
+#endif
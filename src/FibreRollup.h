@@ -0,0 +1,165 @@
+/*
+ * FibreRollup.h
+ *
+ * Pre-aggregated (hourly, daily, ...) values of every fibre, so the plots
+ * of the whole history don't need a point for every 10-minute sample.
+ *
+ * Each tier is a file next to the log (<log>.hourly, <log>.daily) with one
+ * FibreRollup record per fibre and bucket, at position
+ * bucket*nfibres + fibre. A bucket keeps the number of samples and the
+ * minimum, maximum, sum and last value of each metric (attenuation, Ptx,
+ * Prx, temperature), so the mean and a min/max envelope can be drawn.
+ * Buckets with no samples are all zeros.
+ *
+ * Buckets are aligned to the wall clock (full hours, midnight), and
+ * numbered from the first time slot of the log.
+ *
+ * Tiers are updated as the time slots are closed in PlotFibreMonSwitch.C,
+ * and reset together with the checkpoint (see FibreCheckpoint.h). A
+ * sample with x not after the last one of its bucket is ignored, so
+ * replaying slots after an interrupted run does not count them twice.
+ */
+#ifndef FIBREROLLUP_H
+#define FIBREROLLUP_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "FibreCheckpoint.h"
+
+#define FIBREROLLUP_METRICS 4   // Attenuation, Ptx, Prx, Temperature
+
+typedef struct {
+  int n;                        // Samples in the bucket (0 if empty)
+  float last_x;                 // x of the last sample added
+  float min[FIBREROLLUP_METRICS];
+  float max[FIBREROLLUP_METRICS];
+  float sum[FIBREROLLUP_METRICS];
+  float last[FIBREROLLUP_METRICS];
+} FibreRollup;
+
+/*
+ * One tier, open for updating. The bucket being filled is kept in
+ * memory and written out when the next one starts.
+ */
+typedef struct {
+  int fd;
+  int seconds;                  // Bucket size
+  int align;                    // Offset of x = 0 from the start of its bucket
+  int nfibres;
+  long bucket;                  // Bucket in cache, -1 if none
+  int dirty;
+  FibreRollup *cache;
+} FibreRollupTier;
+
+/*
+ * Open the tier <logfile>.<suffix> with buckets of "seconds" seconds.
+ * time0 is the timestamp of x = 0. If reset is set, the tier is emptied.
+ * Returns 0 on success, -1 on error.
+ */
+static int openFibreRollup(const char *logfile, const char *suffix, int seconds, int time0, int nfibres, int reset, FibreRollupTier *tier) {
+  char filename[1000];
+  snprintf(filename, sizeof(filename), "%s.%s", logfile, suffix);
+
+  memset(tier, 0, sizeof(FibreRollupTier));
+  tier->fd = open(filename, O_RDWR | O_CREAT | (reset ? O_TRUNC : 0), 0644);
+  if (tier->fd < 0) {
+    return -1;
+  }
+  tier->seconds = seconds;
+  tier->align = ((time0%seconds) + seconds)%seconds;
+  tier->nfibres = nfibres;
+  tier->bucket = -1;
+  tier->cache = (FibreRollup*)calloc(nfibres, sizeof(FibreRollup));
+
+  return 0;
+}
+
+static void flushFibreRollup(FibreRollupTier *tier) {
+  if ((tier->bucket >= 0) && tier->dirty) {
+    size_t size = tier->nfibres*sizeof(FibreRollup);
+    pwrite(tier->fd, tier->cache, size, tier->bucket*size);
+  }
+  tier->dirty = 0;
+}
+
+/*
+ * Bucket of a time slot (x in seconds from the first slot).
+ */
+static long fibreRollupBucket(const FibreRollupTier *tier, float x) {
+  return ((long)x + tier->align)/tier->seconds;
+}
+
+/*
+ * Add the closed time slot of one fibre to the tier.
+ */
+static void addFibreRollup(FibreRollupTier *tier, const FibreValue *value) {
+  if ((value->fibre_idx < 0) || (value->fibre_idx >= tier->nfibres)) {
+    return;
+  }
+  long bucket = fibreRollupBucket(tier, value->x);
+  if (bucket != tier->bucket) {
+    flushFibreRollup(tier);
+    size_t size = tier->nfibres*sizeof(FibreRollup);
+    ssize_t got = pread(tier->fd, tier->cache, size, bucket*size);
+    if (got < (ssize_t)size) {
+      memset((char*)tier->cache + (got > 0 ? got : 0), 0, size - (got > 0 ? got : 0));
+    }
+    tier->bucket = bucket;
+  }
+
+  FibreRollup *r = &tier->cache[value->fibre_idx];
+  if ((r->n > 0) && (value->x <= r->last_x)) {
+    return;
+  }
+  float v[FIBREROLLUP_METRICS] = {value->att, value->Ptx, value->Prx, value->temperature};
+  for (int m = 0; m < FIBREROLLUP_METRICS; m++) {
+    if ((r->n == 0) || (v[m] < r->min[m])) r->min[m] = v[m];
+    if ((r->n == 0) || (v[m] > r->max[m])) r->max[m] = v[m];
+    r->sum[m] = (r->n == 0) ? v[m] : r->sum[m] + v[m];
+    r->last[m] = v[m];
+  }
+  r->n++;
+  r->last_x = value->x;
+  tier->dirty = 1;
+}
+
+static void closeFibreRollup(FibreRollupTier *tier) {
+  flushFibreRollup(tier);
+  close(tier->fd);
+  free(tier->cache);
+  tier->cache = NULL;
+  tier->fd = -1;
+}
+
+/*
+ * Read the whole tier <logfile>.<suffix>. Returns the number of buckets
+ * (records in *rollups, bucket*nfibres + fibre, to be freed by the
+ * caller), 0 if empty or missing.
+ */
+static long readFibreRollup(const char *logfile, const char *suffix, int nfibres, FibreRollup **rollups) {
+  char filename[1000];
+  snprintf(filename, sizeof(filename), "%s.%s", logfile, suffix);
+  *rollups = NULL;
+
+  FILE *f = fopen(filename, "rb");
+  if (f == NULL) {
+    return 0;
+  }
+  fseek(f, 0, SEEK_END);
+  long nbuckets = ftell(f)/(nfibres*(long)sizeof(FibreRollup));
+  rewind(f);
+  if (nbuckets > 0) {
+    *rollups = (FibreRollup*)malloc(nbuckets*nfibres*sizeof(FibreRollup));
+    nbuckets = fread(*rollups, nfibres*sizeof(FibreRollup), nbuckets, f);
+  }
+  fclose(f);
+
+  return nbuckets;
+}
+
+#endif
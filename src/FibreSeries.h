@@ -0,0 +1,430 @@
+/*
+ * FibreSeries.h
+ *
+ * The time slots of all the fibres, as plotted by PlotFibreMonSwitch.C,
+ * in one contiguous buffer (structure of arrays): for each fibre, a row
+ * with the x of every slot and a row per metric (attenuation, Ptx, Prx,
+ * temperature, same order as FibreRollup.h). Each row can be given as it
+ * is to a TGraph.
+ *
+ * Slots are filled in with fibreSeriesSet() and then closed in order with
+ * fibreSeriesClose(). Closing a slot fills in the fibres that had no
+ * value with the previous one (as the old "fix null values" loop did)
+ * and adds the minimum and maximum over the fibres of each metric to a
+ * segment tree. The minimum and maximum of any range of closed slots are
+ * then found in O(log n), so every plot window (1 h, 24 h, 7 days...)
+ * gets its axis limits without going through the arrays again.
+ *
+ * A slot can still be set after it is closed (rows that come late in
+ * <log>.values): the last value written wins, as it did with the old
+ * arrays. The slots after it that were filled in from it get the new
+ * value, and the tree is updated for all of them.
+ *
+ * The series is kept between runs in <log>.series, together with the
+ * number of <log>.values records already in it, so each run only adds
+ * the records appended since (see saveFibreSeries()).
+ */
+#ifndef FIBRESERIES_H
+#define FIBRESERIES_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "FibreRollup.h"
+
+#define FIBRESERIES_ROWS (1 + FIBREROLLUP_METRICS)   // x and the metrics
+
+typedef struct {
+  int nfibres;
+  int step;                     // Seconds between slots
+  int nslots;                   // Closed slots
+  int capacity;                 // Slots in each row
+  float *buffer;                // [row][fibre][slot]
+  unsigned char *filled;        // [fibre][slot]: 1 if copied from the previous slot
+  int changed;                  // First slot changed since loaded or saved
+  int saved_capacity;           // Capacity of <log>.series, 0 if not written
+
+  // Segment trees, one per metric, over the closed slots. Leaf j is at
+  // leaves + j, node i covers its children 2i and 2i + 1.
+  int leaves;
+  float *tree_min;              // [metric][2*leaves]
+  float *tree_max;
+} FibreSeries;
+
+/*
+ * Row of fibre k: 0 for x, 1 + m for metric m.
+ */
+static inline float *fibreSeriesRow(const FibreSeries *s, int row, int k) {
+  return s->buffer + ((size_t)row*s->nfibres + k)*s->capacity;
+}
+
+/*
+ * Recompute the leaves of the slots from "from" to "to" - 1 and the nodes
+ * above them.
+ */
+static void fibreSeriesUpdateTrees(FibreSeries *s, int from, int to) {
+  if (from >= to) {
+    return;
+  }
+  for (int m = 0; m < FIBREROLLUP_METRICS; m++) {
+    float *tmin = s->tree_min + (size_t)m*2*s->leaves;
+    float *tmax = s->tree_max + (size_t)m*2*s->leaves;
+    for (int j = from; j < to; j++) {
+      tmin[s->leaves + j] = 1e30;
+      tmax[s->leaves + j] = -1e30;
+    }
+    for (int k = 0; k < s->nfibres; k++) {
+      const float *v = fibreSeriesRow(s, 1 + m, k);
+      for (int j = from; j < to; j++) {
+        if (v[j] < tmin[s->leaves + j]) tmin[s->leaves + j] = v[j];
+        if (v[j] > tmax[s->leaves + j]) tmax[s->leaves + j] = v[j];
+      }
+    }
+    // The nodes above a range of leaves are a range on each level
+    for (int l = (s->leaves + from)/2, r = (s->leaves + to - 1)/2; l > 0; l /= 2, r /= 2) {
+      for (int i = l; i <= r; i++) {
+        tmin[i] = tmin[2*i] < tmin[2*i + 1] ? tmin[2*i] : tmin[2*i + 1];
+        tmax[i] = tmax[2*i] > tmax[2*i + 1] ? tmax[2*i] : tmax[2*i + 1];
+      }
+    }
+  }
+}
+
+static void fibreSeriesBuildTrees(FibreSeries *s) {
+  int leaves = 1;
+  while (leaves < s->capacity) leaves *= 2;
+  s->leaves = leaves;
+  free(s->tree_min);
+  free(s->tree_max);
+  s->tree_min = (float*)malloc((size_t)FIBREROLLUP_METRICS*2*leaves*sizeof(float));
+  s->tree_max = (float*)malloc((size_t)FIBREROLLUP_METRICS*2*leaves*sizeof(float));
+  for (size_t i = 0; i < (size_t)FIBREROLLUP_METRICS*2*leaves; i++) {
+    s->tree_min[i] = 1e30;
+    s->tree_max[i] = -1e30;
+  }
+  fibreSeriesUpdateTrees(s, 0, s->nslots);
+}
+
+/*
+ * Make room for at least "capacity" slots. Slots not set yet have x = -1.
+ */
+static void fibreSeriesReserve(FibreSeries *s, int capacity) {
+  if (capacity <= s->capacity) {
+    return;
+  }
+  float *buffer = (float*)malloc((size_t)FIBRESERIES_ROWS*s->nfibres*capacity*sizeof(float));
+  unsigned char *filled = (unsigned char*)calloc((size_t)s->nfibres*capacity, 1);
+  for (int row = 0; row < FIBRESERIES_ROWS; row++) {
+    for (int k = 0; k < s->nfibres; k++) {
+      float *to = buffer + ((size_t)row*s->nfibres + k)*capacity;
+      if (s->capacity > 0) {
+        memcpy(to, fibreSeriesRow(s, row, k), s->capacity*sizeof(float));
+        if (row == 0) {
+          memcpy(filled + (size_t)k*capacity, s->filled + (size_t)k*s->capacity, s->capacity);
+        }
+      }
+      for (int j = s->capacity; j < capacity; j++) {
+        to[j] = (row == 0) ? -1 : 0;
+      }
+    }
+  }
+  free(s->buffer);
+  free(s->filled);
+  s->buffer = buffer;
+  s->filled = filled;
+  s->capacity = capacity;
+  fibreSeriesBuildTrees(s);
+}
+
+static void initFibreSeries(FibreSeries *s, int nfibres, int capacity, int step) {
+  memset(s, 0, sizeof(FibreSeries));
+  s->nfibres = nfibres;
+  s->step = step;
+  fibreSeriesReserve(s, capacity > 0 ? capacity : 1);
+}
+
+static void freeFibreSeries(FibreSeries *s) {
+  free(s->buffer);
+  free(s->filled);
+  free(s->tree_min);
+  free(s->tree_max);
+  memset(s, 0, sizeof(FibreSeries));
+}
+
+/*
+ * Set slot j of fibre k (values in FibreRollup order). If the slot is
+ * already closed, the new values replace the old ones.
+ */
+static void fibreSeriesSet(FibreSeries *s, int k, int j, float x, const float *values) {
+  if ((k < 0) || (k >= s->nfibres) || (j < 0)) {
+    return;
+  }
+  if (j >= s->capacity) {
+    int capacity = 2*s->capacity;
+    fibreSeriesReserve(s, capacity > j ? capacity : j + 1);
+  }
+  fibreSeriesRow(s, 0, k)[j] = x;
+  for (int m = 0; m < FIBREROLLUP_METRICS; m++) {
+    fibreSeriesRow(s, 1 + m, k)[j] = values[m];
+  }
+  s->filled[(size_t)k*s->capacity + j] = 0;
+  if (j >= s->nslots) {
+    return;
+  }
+
+  // Closed: the slots filled in from this one change too
+  const unsigned char *filled = s->filled + (size_t)k*s->capacity;
+  int last = j + 1;
+  for (; (last < s->nslots) && filled[last]; last++) {
+    fibreSeriesRow(s, 0, k)[last] = fibreSeriesRow(s, 0, k)[last - 1] + s->step;
+    for (int m = 0; m < FIBREROLLUP_METRICS; m++) {
+      float *v = fibreSeriesRow(s, 1 + m, k);
+      v[last] = v[last - 1];
+    }
+  }
+  fibreSeriesUpdateTrees(s, j, last);
+  if (j < s->changed) {
+    s->changed = j;
+  }
+}
+
+/*
+ * Close all the slots before "upto".
+ */
+static void fibreSeriesClose(FibreSeries *s, int upto) {
+  if (upto <= s->nslots) {
+    return;
+  }
+  if (upto > s->capacity) {
+    fibreSeriesReserve(s, upto > 2*s->capacity ? upto : 2*s->capacity);
+  }
+  for (int k = 0; k < s->nfibres; k++) {
+    float *x = fibreSeriesRow(s, 0, k);
+    unsigned char *filled = s->filled + (size_t)k*s->capacity;
+    for (int j = s->nslots; j < upto; j++) {
+      if (x[j] >= 0) continue;
+      // No value: same as the previous slot
+      x[j] = (j > 0) ? x[j - 1] + s->step : s->step;
+      for (int m = 0; m < FIBREROLLUP_METRICS; m++) {
+        float *v = fibreSeriesRow(s, 1 + m, k);
+        v[j] = (j > 0) ? v[j - 1] : 0;
+      }
+      filled[j] = (j > 0);
+    }
+  }
+  fibreSeriesUpdateTrees(s, s->nslots, upto);
+  if (s->nslots < s->changed) {
+    s->changed = s->nslots;
+  }
+  s->nslots = upto;
+}
+
+/*
+ * Minimum and maximum of metric m over all the fibres, for the closed
+ * slots from "from" to "to" - 1. Returns 0 if there are none.
+ */
+static int fibreSeriesRange(const FibreSeries *s, int m, int from, int to, float *vmin, float *vmax) {
+  if (from < 0) from = 0;
+  if (to > s->nslots) to = s->nslots;
+  *vmin = 1e30;
+  *vmax = -1e30;
+  if (from >= to) {
+    return 0;
+  }
+  const float *tmin = s->tree_min + (size_t)m*2*s->leaves;
+  const float *tmax = s->tree_max + (size_t)m*2*s->leaves;
+  for (int l = from + s->leaves, r = to + s->leaves; l < r; l /= 2, r /= 2) {
+    if (l & 1) {
+      if (tmin[l] < *vmin) *vmin = tmin[l];
+      if (tmax[l] > *vmax) *vmax = tmax[l];
+      l++;
+    }
+    if (r & 1) {
+      r--;
+      if (tmin[r] < *vmin) *vmin = tmin[r];
+      if (tmax[r] > *vmax) *vmax = tmax[r];
+    }
+  }
+
+  return 1;
+}
+
+/*
+ * Header of <log>.series, followed by the buffer, the filled flags and
+ * the trees, as they are in memory.
+ */
+#define FIBRESERIES_MAGIC "FSERIES1"
+
+typedef struct {
+  char magic[8];
+  unsigned int fibremap_hash;
+  int nfibres;
+  int step;
+  int time0;
+  int nslots;
+  int capacity;
+  long nvalues;                 // Records of <log>.values in the series, -1 while it is written
+} FibreSeriesHeader;
+
+static size_t fibreSeriesFileSize(int nfibres, int capacity, int leaves) {
+  return sizeof(FibreSeriesHeader) + (size_t)FIBRESERIES_ROWS*nfibres*capacity*sizeof(float) +
+         (size_t)nfibres*capacity + (size_t)2*FIBREROLLUP_METRICS*2*leaves*sizeof(float);
+}
+
+/*
+ * Load <logfile>.series into s (set up with initFibreSeries()), if it was
+ * saved for the same fibre map, step and time0, with no more than
+ * max_nvalues records of <log>.values. Returns the number of records
+ * already in the series, or -1 if it has to be built from the beginning
+ * (s is then left as it was).
+ */
+static long loadFibreSeries(const char *logfile, FibreSeries *s, unsigned int fibremap_hash, int time0, long max_nvalues) {
+  char filename[1000];
+  snprintf(filename, sizeof(filename), "%s.series", logfile);
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0) {
+    return -1;
+  }
+  FibreSeriesHeader h;
+  if ((pread(fd, &h, sizeof(h), 0) != sizeof(h)) || (memcmp(h.magic, FIBRESERIES_MAGIC, 8) != 0) ||
+      (h.fibremap_hash != fibremap_hash) || (h.nfibres != s->nfibres) || (h.step != s->step) || (h.time0 != time0) ||
+      (h.nvalues < 0) || (h.nvalues > max_nvalues) || (h.nslots < 0) || (h.capacity < 1) || (h.nslots > h.capacity)) {
+    close(fd);
+    return -1;
+  }
+  int leaves = 1;
+  while (leaves < h.capacity) leaves *= 2;
+  struct stat st;
+  if ((fstat(fd, &st) != 0) || ((size_t)st.st_size != fibreSeriesFileSize(h.nfibres, h.capacity, leaves))) {
+    close(fd);
+    return -1;
+  }
+
+  size_t nbuffer = (size_t)FIBRESERIES_ROWS*h.nfibres*h.capacity*sizeof(float);
+  size_t nfilled = (size_t)h.nfibres*h.capacity;
+  size_t ntree = (size_t)FIBREROLLUP_METRICS*2*leaves*sizeof(float);
+  float *buffer = (float*)malloc(nbuffer);
+  unsigned char *filled = (unsigned char*)malloc(nfilled);
+  float *tree_min = (float*)malloc(ntree);
+  float *tree_max = (float*)malloc(ntree);
+  off_t pos = sizeof(h);
+  int ok = (pread(fd, buffer, nbuffer, pos) == (ssize_t)nbuffer) &&
+           (pread(fd, filled, nfilled, pos + nbuffer) == (ssize_t)nfilled) &&
+           (pread(fd, tree_min, ntree, pos + nbuffer + nfilled) == (ssize_t)ntree) &&
+           (pread(fd, tree_max, ntree, pos + nbuffer + nfilled + ntree) == (ssize_t)ntree);
+  close(fd);
+  if (!ok) {
+    free(buffer);
+    free(filled);
+    free(tree_min);
+    free(tree_max);
+    return -1;
+  }
+
+  free(s->buffer);
+  free(s->filled);
+  free(s->tree_min);
+  free(s->tree_max);
+  s->buffer = buffer;
+  s->filled = filled;
+  s->tree_min = tree_min;
+  s->tree_max = tree_max;
+  s->capacity = h.capacity;
+  s->leaves = leaves;
+  s->nslots = h.nslots;
+  s->changed = h.nslots;
+  s->saved_capacity = h.capacity;
+
+  // Slots not closed yet start empty again
+  for (int k = 0; k < s->nfibres; k++) {
+    for (int j = s->nslots; j < s->capacity; j++) {
+      fibreSeriesRow(s, 0, k)[j] = -1;
+      for (int m = 0; m < FIBREROLLUP_METRICS; m++) {
+        fibreSeriesRow(s, 1 + m, k)[j] = 0;
+      }
+      s->filled[(size_t)k*s->capacity + j] = 0;
+    }
+  }
+
+  return h.nvalues;
+}
+
+/*
+ * Save s to <logfile>.series, with the number of records of <log>.values
+ * that are in it. Only the slots changed since it was loaded (or last
+ * saved) and the tree nodes above them are written, unless the capacity
+ * changed. The header is marked as not valid while writing, so an
+ * interrupted run makes the next one build the series again.
+ * Returns 1 on success.
+ */
+static int saveFibreSeries(const char *logfile, FibreSeries *s, unsigned int fibremap_hash, int time0, long nvalues) {
+  char filename[1000];
+  snprintf(filename, sizeof(filename), "%s.series", logfile);
+  int whole = (s->saved_capacity != s->capacity);
+  int fd = open(filename, O_RDWR | O_CREAT | (whole ? O_TRUNC : 0), 0644);
+  if (fd < 0) {
+    return 0;
+  }
+
+  FibreSeriesHeader h;
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, FIBRESERIES_MAGIC, 8);
+  h.fibremap_hash = fibremap_hash;
+  h.nfibres = s->nfibres;
+  h.step = s->step;
+  h.time0 = time0;
+  h.nslots = s->nslots;
+  h.capacity = s->capacity;
+  h.nvalues = -1;
+  int ok = (pwrite(fd, &h, sizeof(h), 0) == sizeof(h));
+
+  int from = whole ? 0 : s->changed;
+  int to = whole ? s->capacity : s->nslots;
+  size_t nbuffer = (size_t)FIBRESERIES_ROWS*s->nfibres*s->capacity*sizeof(float);
+  size_t nfilled = (size_t)s->nfibres*s->capacity;
+  size_t ntree = (size_t)FIBREROLLUP_METRICS*2*s->leaves*sizeof(float);
+  off_t pos = sizeof(h);
+  if (from < to) {
+    for (int row = 0; ok && (row < FIBRESERIES_ROWS); row++) {
+      for (int k = 0; ok && (k < s->nfibres); k++) {
+        size_t at = ((size_t)row*s->nfibres + k)*s->capacity + from;
+        ok = (pwrite(fd, s->buffer + at, (to - from)*sizeof(float), pos + at*sizeof(float)) == (ssize_t)((to - from)*sizeof(float)));
+      }
+    }
+    for (int k = 0; ok && (k < s->nfibres); k++) {
+      size_t at = (size_t)k*s->capacity + from;
+      ok = (pwrite(fd, s->filled + at, to - from, pos + nbuffer + at) == (ssize_t)(to - from));
+    }
+  }
+  if (whole) {
+    ok = ok && (pwrite(fd, s->tree_min, ntree, pos + nbuffer + nfilled) == (ssize_t)ntree) &&
+         (pwrite(fd, s->tree_max, ntree, pos + nbuffer + nfilled + ntree) == (ssize_t)ntree);
+  }
+  else if (from < to) {
+    // The nodes above a range of leaves are a range on each level
+    for (int m = 0; ok && (m < FIBREROLLUP_METRICS); m++) {
+      for (int l = s->leaves + from, r = s->leaves + to - 1; ok && (l > 0); l /= 2, r /= 2) {
+        size_t at = (size_t)m*2*s->leaves + l;
+        size_t len = (r - l + 1)*sizeof(float);
+        ok = (pwrite(fd, s->tree_min + at, len, pos + nbuffer + nfilled + at*sizeof(float)) == (ssize_t)len) &&
+             (pwrite(fd, s->tree_max + at, len, pos + nbuffer + nfilled + ntree + at*sizeof(float)) == (ssize_t)len);
+      }
+    }
+  }
+
+  h.nvalues = nvalues;
+  ok = ok && (pwrite(fd, &h, sizeof(h), 0) == sizeof(h));
+  if ((close(fd) != 0) || !ok) {
+    return 0;
+  }
+  s->changed = s->nslots;
+  s->saved_capacity = s->capacity;
+
+  return 1;
+}
+
+#endif
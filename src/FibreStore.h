@@ -0,0 +1,399 @@
+/*
+ * FibreStore.h
+ *
+ * Binary time-series store for the SFP readings, as an alternative to
+ * parsing MergedLog.txt from text on every run.
+ *
+ * A store is a directory with two files per switch port:
+ *
+ *  - <hostname>_<port>.dat: a 16-byte header ("FIBRESTO", version, record
+ *    size) followed by fixed-size FibreStoreRecord records, in time order.
+ *  - <hostname>_<port>.idx: the time of every FIBRESTORE_STRIDE-th record
+ *    (sparse index), as plain ints.
+ *
+ * Readers mmap() both files and binary-search the index and then one
+ * block of records, so a query for the last few hours only touches a
+ * handful of pages however long the history is.
+ *
+ * Writers only append. A record that is not newer than the last one of
+ * its port is dropped, so appending the same log twice does no harm.
+ * A partially written record (e.g. power cut) is cut off the next time
+ * the file is opened for writing, and the index is brought up to date
+ * with the data.
+ *
+ * FibreStoreAppend.cxx fills a store from MergedLog.txt or SwitchLog.txt
+ * files.
+ */
+#ifndef FIBRESTORE_H
+#define FIBRESTORE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "FibreLogReader.h"
+
+#define FIBRESTORE_MAGIC "FIBRESTO"
+#define FIBRESTORE_VERSION 1
+#define FIBRESTORE_HEADER 16
+#define FIBRESTORE_STRIDE 512
+
+typedef struct {
+  int time;             // Same timestamps as FibreLogReader.h
+  float temp;
+  float voltage;
+  float current;
+  float Ptx;
+  float Prx;
+} FibreStoreRecord;
+
+/*
+ * One port of the store, mapped in memory for reading.
+ */
+typedef struct {
+  char hostname[FIBRELOG_HOSTLEN];
+  int port;
+  long nrecords;
+  const FibreStoreRecord *records;
+  long nindex;
+  const int *index;
+  void *dat_map;
+  size_t dat_size;
+  void *idx_map;
+  size_t idx_size;
+} FibreStoreSeries;
+
+/*
+ * One port of the store, open for appending.
+ */
+typedef struct {
+  int dat_fd;
+  int idx_fd;
+  long nrecords;
+  int last_time;
+} FibreStoreWriter;
+
+static void fibreStorePath(char *path, int len, const char *dir, const char *hostname, int port, const char *ext) {
+  snprintf(path, len, "%s/%s_%d.%s", dir, hostname, port, ext);
+}
+
+/*
+ * Open (creating it if needed) the files of hostname:port in dir for
+ * appending. Returns 0 on success, -1 on error.
+ */
+static int openFibreStoreWriter(const char *dir, const char *hostname, int port, FibreStoreWriter *w) {
+  char path[1000];
+  struct stat st;
+
+  mkdir(dir, 0755);
+  fibreStorePath(path, sizeof(path), dir, hostname, port, "dat");
+  w->dat_fd = open(path, O_RDWR | O_CREAT, 0644);
+  fibreStorePath(path, sizeof(path), dir, hostname, port, "idx");
+  w->idx_fd = open(path, O_RDWR | O_CREAT, 0644);
+  if ((w->dat_fd < 0) || (w->idx_fd < 0) || (fstat(w->dat_fd, &st) != 0)) {
+    if (w->dat_fd >= 0) close(w->dat_fd);
+    if (w->idx_fd >= 0) close(w->idx_fd);
+    return -1;
+  }
+
+  // New file: write the header
+  if (st.st_size < FIBRESTORE_HEADER) {
+    char header[FIBRESTORE_HEADER];
+    int version = FIBRESTORE_VERSION, recsize = sizeof(FibreStoreRecord);
+    memcpy(header, FIBRESTORE_MAGIC, 8);
+    memcpy(header + 8, &version, 4);
+    memcpy(header + 12, &recsize, 4);
+    if ((ftruncate(w->dat_fd, 0) != 0) || (pwrite(w->dat_fd, header, FIBRESTORE_HEADER, 0) != FIBRESTORE_HEADER)) {
+      close(w->dat_fd);
+      close(w->idx_fd);
+      return -1;
+    }
+    st.st_size = FIBRESTORE_HEADER;
+  }
+
+  // Drop a half-written record
+  w->nrecords = (st.st_size - FIBRESTORE_HEADER)/sizeof(FibreStoreRecord);
+  if (ftruncate(w->dat_fd, FIBRESTORE_HEADER + w->nrecords*sizeof(FibreStoreRecord)) != 0) {
+    close(w->dat_fd);
+    close(w->idx_fd);
+    return -1;
+  }
+
+  // Make the index agree with the data
+  long nindex = (w->nrecords + FIBRESTORE_STRIDE - 1)/FIBRESTORE_STRIDE;
+  fstat(w->idx_fd, &st);
+  long have = st.st_size/sizeof(int);
+  if (have > nindex) {
+    have = nindex;
+  }
+  if (ftruncate(w->idx_fd, have*sizeof(int)) != 0) {
+    close(w->dat_fd);
+    close(w->idx_fd);
+    return -1;
+  }
+  for (long i = have; i < nindex; i++) {
+    int t;
+    pread(w->dat_fd, &t, sizeof(int), FIBRESTORE_HEADER + i*FIBRESTORE_STRIDE*sizeof(FibreStoreRecord));
+    pwrite(w->idx_fd, &t, sizeof(int), i*sizeof(int));
+  }
+
+  w->last_time = -2147483647 - 1;
+  if (w->nrecords > 0) {
+    pread(w->dat_fd, &w->last_time, sizeof(int), FIBRESTORE_HEADER + (w->nrecords - 1)*sizeof(FibreStoreRecord));
+  }
+
+  return 0;
+}
+
+/*
+ * Append one record. Records not newer than the last one are ignored.
+ * Returns 1 if appended, 0 if ignored, -1 on error.
+ */
+static int fibreStoreAppend(FibreStoreWriter *w, const FibreStoreRecord *rec) {
+  if (rec->time <= w->last_time) {
+    return 0;
+  }
+  off_t pos = FIBRESTORE_HEADER + w->nrecords*sizeof(FibreStoreRecord);
+  if (pwrite(w->dat_fd, rec, sizeof(FibreStoreRecord), pos) != sizeof(FibreStoreRecord)) {
+    return -1;
+  }
+  if (w->nrecords%FIBRESTORE_STRIDE == 0) {
+    pwrite(w->idx_fd, &rec->time, sizeof(int), w->nrecords/FIBRESTORE_STRIDE*sizeof(int));
+  }
+  w->nrecords++;
+  w->last_time = rec->time;
+
+  return 1;
+}
+
+static void closeFibreStoreWriter(FibreStoreWriter *w) {
+  close(w->dat_fd);
+  close(w->idx_fd);
+  w->dat_fd = -1;
+  w->idx_fd = -1;
+}
+
+/*
+ * Map the files of hostname:port in dir for reading.
+ * Returns 0 on success, -1 if missing or not a store file.
+ */
+static int openFibreStoreSeries(const char *dir, const char *hostname, int port, FibreStoreSeries *s) {
+  char path[1000];
+  struct stat st;
+
+  memset(s, 0, sizeof(FibreStoreSeries));
+  snprintf(s->hostname, sizeof(s->hostname), "%s", hostname);
+  s->port = port;
+
+  fibreStorePath(path, sizeof(path), dir, hostname, port, "dat");
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    return -1;
+  }
+  fstat(fd, &st);
+  if (st.st_size < FIBRESTORE_HEADER) {
+    close(fd);
+    return -1;
+  }
+  s->dat_size = st.st_size;
+  s->dat_map = mmap(NULL, s->dat_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (s->dat_map == MAP_FAILED) {
+    s->dat_map = NULL;
+    return -1;
+  }
+  int recsize;
+  memcpy(&recsize, (char*)s->dat_map + 12, 4);
+  if ((memcmp(s->dat_map, FIBRESTORE_MAGIC, 8) != 0) || (recsize != (int)sizeof(FibreStoreRecord))) {
+    munmap(s->dat_map, s->dat_size);
+    s->dat_map = NULL;
+    return -1;
+  }
+  s->records = (const FibreStoreRecord*)((char*)s->dat_map + FIBRESTORE_HEADER);
+  s->nrecords = (s->dat_size - FIBRESTORE_HEADER)/sizeof(FibreStoreRecord);
+
+  // Without the index the data can still be searched, just touching more pages
+  fibreStorePath(path, sizeof(path), dir, hostname, port, "idx");
+  fd = open(path, O_RDONLY);
+  if (fd >= 0) {
+    fstat(fd, &st);
+    if (st.st_size >= (off_t)sizeof(int)) {
+      s->idx_size = st.st_size;
+      s->idx_map = mmap(NULL, s->idx_size, PROT_READ, MAP_SHARED, fd, 0);
+      if (s->idx_map == MAP_FAILED) {
+        s->idx_map = NULL;
+      }
+      else {
+        s->index = (const int*)s->idx_map;
+        s->nindex = s->idx_size/sizeof(int);
+        if (s->nindex > (s->nrecords + FIBRESTORE_STRIDE - 1)/FIBRESTORE_STRIDE) {
+          s->nindex = (s->nrecords + FIBRESTORE_STRIDE - 1)/FIBRESTORE_STRIDE;
+        }
+      }
+    }
+    close(fd);
+  }
+
+  return 0;
+}
+
+static void closeFibreStoreSeries(FibreStoreSeries *s) {
+  if (s->dat_map != NULL) munmap(s->dat_map, s->dat_size);
+  if (s->idx_map != NULL) munmap(s->idx_map, s->idx_size);
+  memset(s, 0, sizeof(FibreStoreSeries));
+}
+
+/*
+ * Position of the first record with time >= t (nrecords if none).
+ */
+static long fibreStoreLowerBound(const FibreStoreSeries *s, int t) {
+  long lo = 0, hi = s->nrecords;
+
+  // Narrow down to one block with the sparse index
+  if (s->nindex > 0) {
+    long a = 0, b = s->nindex;
+    while (a < b) {
+      long mid = (a + b)/2;
+      if (s->index[mid] < t) a = mid + 1;
+      else b = mid;
+    }
+    // Block a starts at or after t, so the answer is in block a - 1
+    if (a > 0) lo = (a - 1)*FIBRESTORE_STRIDE;
+    if (a < s->nindex) hi = a*FIBRESTORE_STRIDE;
+  }
+
+  while (lo < hi) {
+    long mid = (lo + hi)/2;
+    if (s->records[mid].time < t) lo = mid + 1;
+    else hi = mid;
+  }
+
+  return lo;
+}
+
+/*
+ * Parse a store file name "<hostname>_<port>.dat".
+ * Returns 1 if it is one, 0 otherwise.
+ */
+static int fibreStoreParseName(const char *name, char *hostname, int *port) {
+  int len = strlen(name);
+  if ((len < 7) || (strcmp(name + len - 4, ".dat") != 0)) {
+    return 0;
+  }
+  const char *underscore = strrchr(name, '_');
+  if ((underscore == NULL) || (underscore - name >= FIBRELOG_HOSTLEN)) {
+    return 0;
+  }
+  memcpy(hostname, name, underscore - name);
+  hostname[underscore - name] = '\0';
+  *port = atoi(underscore + 1);
+
+  return 1;
+}
+
+/*
+ * Open every port of the store in dir. Returns the number of series
+ * (array in *series, to be freed with closeFibreStore()), or -1 if dir
+ * is not there.
+ */
+static int openFibreStore(const char *dir, FibreStoreSeries **series) {
+  DIR *d = opendir(dir);
+  if (d == NULL) {
+    return -1;
+  }
+  int n = 0, capacity = 0;
+  *series = NULL;
+  struct dirent *ent;
+  while ((ent = readdir(d)) != NULL) {
+    char hostname[FIBRELOG_HOSTLEN];
+    int port;
+    if (!fibreStoreParseName(ent->d_name, hostname, &port)) {
+      continue;
+    }
+    if (n == capacity) {
+      capacity = capacity ? 2*capacity : 16;
+      *series = (FibreStoreSeries*)realloc(*series, capacity*sizeof(FibreStoreSeries));
+    }
+    if (openFibreStoreSeries(dir, hostname, port, &(*series)[n]) == 0) {
+      n++;
+    }
+  }
+  closedir(d);
+
+  return n;
+}
+
+static void closeFibreStore(FibreStoreSeries *series, int n) {
+  for (int i = 0; i < n; i++) {
+    closeFibreStoreSeries(&series[i]);
+  }
+  free(series);
+}
+
+/*
+ * Time of the newest record in the store (or -1 if empty).
+ */
+static int fibreStoreLastTime(const FibreStoreSeries *series, int n) {
+  int last = -1;
+  for (int i = 0; i < n; i++) {
+    if ((series[i].nrecords > 0) && (series[i].records[series[i].nrecords - 1].time > last)) {
+      last = series[i].records[series[i].nrecords - 1].time;
+    }
+  }
+
+  return last;
+}
+
+/*
+ * Fill log (zeroed or freshly cleared) with the records of all the ports
+ * with tmin <= time <= tmax, in time order, as if they had been read from
+ * MergedLog.txt. Returns the number of rows.
+ */
+static int loadFibreStoreRange(const FibreStoreSeries *series, int n, int tmin, int tmax, FibreLog *log) {
+  long *pos = (long*)calloc(n > 0 ? n : 1, sizeof(long));
+  int *endpoint = (int*)calloc(n > 0 ? n : 1, sizeof(int));
+  for (int i = 0; i < n; i++) {
+    char token[FIBRELOG_HOSTLEN + 20];
+    int len = snprintf(token, sizeof(token), "%s:%d", series[i].hostname, series[i].port);
+    endpoint[i] = fibreLogEndpoint(log, token, len);
+    pos[i] = fibreStoreLowerBound(&series[i], tmin);
+  }
+
+  // Merge the ports by time
+  while (1) {
+    int best = -1;
+    for (int i = 0; i < n; i++) {
+      if ((pos[i] < series[i].nrecords) && (series[i].records[pos[i]].time <= tmax) &&
+          ((best < 0) || (series[i].records[pos[i]].time < series[best].records[pos[best]].time))) {
+        best = i;
+      }
+    }
+    if (best < 0) {
+      break;
+    }
+    const FibreStoreRecord *rec = &series[best].records[pos[best]++];
+    if (log->nrows == log->capacity) {
+      fibreLogGrow(log);
+    }
+    int r = log->nrows++;
+    log->time[r] = rec->time;
+    log->endpoint[r] = endpoint[best];
+    log->temp[r] = rec->temp;
+    log->voltage[r] = rec->voltage;
+    log->current[r] = rec->current;
+    log->Ptx[r] = rec->Ptx;
+    log->Prx[r] = rec->Prx;
+  }
+
+  free(pos);
+  free(endpoint);
+
+  return log->nrows;
+}
+
+#endif
@@ -0,0 +1,88 @@
+/*
+ * FibreStoreAppend
+ *
+ * Use:
+ *
+ *  - FibreStoreAppend <store directory> <log file> [<log file> ...]
+ *
+ * Appends the rows of MergedLog.txt-style files (MergedLog.txt itself,
+ * old archives of it or the SwitchLog.txt of one read-out) to the binary
+ * store described in FibreStore.h. Converting an existing archive is
+ * just appending it to an empty store; rows already in the store are
+ * skipped, so running it again on the same file is harmless.
+ *
+ * Compile with:
+ *
+ *  g++ -O2 -o FibreStoreAppend FibreStoreAppend.cxx
+ */
+#include <stdio.h>
+
+#include "FibreLogReader.h"
+#include "FibreStore.h"
+
+int main(int argc, char **argv) {
+  if (argc < 3) {
+    fprintf(stderr, "Use: %s <store directory> <log file> [<log file> ...]\n", argv[0]);
+    return 1;
+  }
+  const char *dir = argv[1];
+  int status = 0;
+
+  for (int f = 2; f < argc; f++) {
+    FibreLog log;
+    memset(&log, 0, sizeof(log));
+    if (readFibreLog(argv[f], &log) < 0) {
+      fprintf(stderr, "Cannot read %s\n", argv[f]);
+      status = 1;
+      continue;
+    }
+
+    // One writer per hostname:port of this file
+    FibreStoreWriter *writers = (FibreStoreWriter*)calloc(log.nendpoints > 0 ? log.nendpoints : 1, sizeof(FibreStoreWriter));
+    int *opened = (int*)calloc(log.nendpoints > 0 ? log.nendpoints : 1, sizeof(int));
+    long appended = 0, skipped = 0;
+    for (int pos = 0; pos < log.nrows; pos++) {
+      int e = log.endpoint[pos];
+      if (opened[e] == 0) {
+        opened[e] = (openFibreStoreWriter(dir, log.endpoints[e].hostname, log.endpoints[e].port, &writers[e]) == 0) ? 1 : -1;
+        if (opened[e] < 0) {
+          fprintf(stderr, "Cannot open %s:%d in %s\n", log.endpoints[e].hostname, log.endpoints[e].port, dir);
+          status = 1;
+        }
+      }
+      if (opened[e] < 0) {
+        continue;
+      }
+      FibreStoreRecord rec;
+      rec.time = log.time[pos];
+      rec.temp = log.temp[pos];
+      rec.voltage = log.voltage[pos];
+      rec.current = log.current[pos];
+      rec.Ptx = log.Ptx[pos];
+      rec.Prx = log.Prx[pos];
+      int r = fibreStoreAppend(&writers[e], &rec);
+      if (r > 0) {
+        appended++;
+      }
+      else if (r == 0) {
+        skipped++;
+      }
+      else {
+        fprintf(stderr, "Cannot write %s:%d in %s\n", log.endpoints[e].hostname, log.endpoints[e].port, dir);
+        status = 1;
+      }
+    }
+    for (int e = 0; e < log.nendpoints; e++) {
+      if (opened[e] > 0) {
+        closeFibreStoreWriter(&writers[e]);
+      }
+    }
+    printf("%s: %ld rows appended, %ld already in the store\n", argv[f], appended, skipped);
+
+    free(writers);
+    free(opened);
+    freeFibreLog(&log);
+  }
+
+  return status;
+}
@@ -0,0 +1,258 @@
+/*
+ * SfpParser.h
+ *
+ * Streaming parser for the answer of an MGSD-10080F to "port sfp".
+ * Does the same as ProcessData.sh, but in-process and on the bytes as
+ * they arrive from the session, without temp.txt or SwitchLog.txt:
+ *
+ *  - the hostname comes from the first line with a prompt (">"), in
+ *    lower case, up to the ":",
+ *  - the table starts after the line whose first field has "Temperature"
+ *    (and at least 6 fields),
+ *  - each port takes two lines: a first one starting with the port number
+ *    and a second one with temperature, voltage, current, Ptx and Prx.
+ *    Ports with "--" in the second field are skipped,
+ *  - at port "10" everything starts over,
+ *  - a negative temperature is the read-out problem that made
+ *    ProcessData.sh print "Error": it is counted in nerrors instead.
+ *
+ * The raw answer is kept in memory (up to SFP_MAXRAW bytes), to be saved
+ * only if it has to be looked at.
+ *
+ * Use:
+ *
+ *   startSfpAnswer(&parser, prompt_line);    // before sending "port sfp"
+ *   feedSfpParser(&parser, data, len);       // as the bytes arrive...
+ *   if (parser.prompt_seen)                  // ...until the next prompt
+ *     finishSfpAnswer(&parser);
+ *   // parser.records[0 .. nrecords-1], parser.nerrors, parser.raw
+ */
+#ifndef SFPPARSER_H
+#define SFPPARSER_H
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define SFP_MAXLINE 1000
+#define SFP_MAXFIELDS 16
+#define SFP_MAXRAW 100000
+#define SFP_FIELDLEN 16
+#define SFP_HOSTLEN 100
+#define SFP_PROMPT "/>"
+
+typedef struct {
+  char hostname[SFP_HOSTLEN];
+  int port;
+  float temp;
+  float voltage;
+  float current;
+  float Ptx;
+  float Prx;
+  char text[5][SFP_FIELDLEN];   // The five values as printed by the switch
+} SfpRecord;
+
+typedef struct {
+  // State of the ProcessData.sh state machine
+  int write;
+  int firstline;
+  int port;
+  char hostname[SFP_HOSTLEN];
+
+  // Line being assembled
+  char line[SFP_MAXLINE];
+  int linelen;
+
+  // Results
+  SfpRecord *records;
+  int nrecords;
+  int capacity;
+  int nerrors;                  // Ports with negative values
+  int error_port;               // First of them
+  int prompt_seen;              // The answer is complete
+
+  char *raw;
+  int rawlen;
+} SfpParser;
+
+static void initSfpParser(SfpParser *p) {
+  memset(p, 0, sizeof(SfpParser));
+  p->raw = (char*)malloc(SFP_MAXRAW + 1);
+  p->raw[0] = '\0';
+}
+
+static void freeSfpParser(SfpParser *p) {
+  free(p->records);
+  free(p->raw);
+  memset(p, 0, sizeof(SfpParser));
+}
+
+/*
+ * Split a line in blank-separated fields, like awk with FS=" ".
+ */
+static int sfpFields(char *line, char **fields) {
+  int n = 0;
+  char *p = line;
+  while (*p != '\0') {
+    while ((*p == ' ') || (*p == '\t')) p++;
+    if (*p == '\0') break;
+    if (n < SFP_MAXFIELDS) fields[n] = p;
+    n++;
+    while ((*p != '\0') && (*p != ' ') && (*p != '\t')) p++;
+    if (*p != '\0') *p++ = '\0';
+  }
+
+  return n;
+}
+
+/*
+ * Process one complete line (without \r or \n).
+ */
+static void sfpParseLine(SfpParser *p, char *line) {
+  char *f[SFP_MAXFIELDS];
+  int has_prompt = (strchr(line, '>') != NULL);
+  int nf = sfpFields(line, f);
+
+  if ((p->hostname[0] == '\0') && has_prompt && (nf > 0)) {  // Get the hostname from a prompt line
+    char *colon = strchr(f[0], ':');
+    if (colon != NULL) {
+      int len = colon - f[0];
+      if (len >= SFP_HOSTLEN) len = SFP_HOSTLEN - 1;
+      for (int i = 0; i < len; i++) {
+        p->hostname[i] = tolower((unsigned char)f[0][i]);
+      }
+      p->hostname[len] = '\0';
+    }
+  }
+  if (nf == 0) {
+    return;
+  }
+  const char *second = (nf > 1) ? f[1] : "";
+
+  if ((p->write == 0) && (nf >= 6)) {   // Find the header of the SFP diagnostics info
+    if (strstr(f[0], "Temperature") != NULL) {
+      p->write = 1;
+    }
+  } else if (p->write == 1) {
+    if ((p->firstline == 0) && (strcmp(second, "--") != 0)) {  // Second line of the port info
+      if (strtod(f[0], NULL) < 0) {
+        if (p->nerrors++ == 0) {
+          p->error_port = p->port;
+        }
+      } else {
+        if (p->nrecords == p->capacity) {
+          p->capacity = p->capacity ? 2*p->capacity : 16;
+          p->records = (SfpRecord*)realloc(p->records, p->capacity*sizeof(SfpRecord));
+        }
+        SfpRecord *r = &p->records[p->nrecords++];
+        strcpy(r->hostname, p->hostname);
+        r->port = p->port;
+        float *values[5] = {&r->temp, &r->voltage, &r->current, &r->Ptx, &r->Prx};
+        for (int i = 0; i < 5; i++) {
+          const char *text = (i < nf) ? f[i] : "";
+          snprintf(r->text[i], SFP_FIELDLEN, "%s", text);
+          *values[i] = strtod(text, NULL);
+        }
+      }
+      p->firstline = 1;
+    } else if ((p->firstline == 1) && (strcmp(second, "--") != 0) && (strpbrk(f[0], "0123456789") != NULL)) {
+      p->port = (int)strtol(f[0], NULL, 0);    // First line of the port info
+      p->firstline = 0;
+    }
+    if (strcmp(f[0], "10") == 0) {   // When we get to the last port, start over
+      p->write = 0;
+      p->hostname[0] = '\0';
+      p->firstline = 1;
+    }
+  }
+}
+
+/*
+ * Feed bytes of the answer. \r are dropped, like in switchread.sh.
+ */
+static void feedSfpParser(SfpParser *p, const char *data, int len) {
+  int keep = SFP_MAXRAW - p->rawlen;
+  if (keep > len) keep = len;
+  if (keep > 0) {
+    memcpy(p->raw + p->rawlen, data, keep);
+    p->rawlen += keep;
+    p->raw[p->rawlen] = '\0';
+  }
+
+  for (int i = 0; i < len; i++) {
+    char c = data[i];
+    if (c == '\r') {
+      continue;
+    }
+    if (c == '\n') {
+      p->line[p->linelen] = '\0';
+      sfpParseLine(p, p->line);
+      p->linelen = 0;
+      continue;
+    }
+    if (p->linelen < SFP_MAXLINE - 1) {
+      p->line[p->linelen++] = c;
+    }
+  }
+
+  // The answer ends with the prompt, without a newline
+  if (p->linelen >= (int)strlen(SFP_PROMPT)) {
+    p->line[p->linelen] = '\0';
+    if (strstr(p->line, SFP_PROMPT) != NULL) {
+      p->prompt_seen = 1;
+    }
+  }
+}
+
+/*
+ * Get ready for a new answer. The prompt line seen before sending the
+ * command (e.g. "BISMONITORSW1:/>") gives the hostname, as in the
+ * buffer of switchread.sh.
+ */
+static void startSfpAnswer(SfpParser *p, const char *prompt) {
+  p->write = 0;
+  p->firstline = 1;
+  p->port = 0;
+  p->hostname[0] = '\0';
+  p->linelen = 0;
+  p->nrecords = 0;
+  p->nerrors = 0;
+  p->error_port = 0;
+  p->rawlen = 0;
+  p->raw[0] = '\0';
+  if ((prompt != NULL) && (prompt[0] != '\0')) {
+    feedSfpParser(p, prompt, strlen(prompt));
+    feedSfpParser(p, "\n", 1);
+  }
+  p->prompt_seen = 0;
+}
+
+/*
+ * Process the last line, if it had no newline.
+ */
+static void finishSfpAnswer(SfpParser *p) {
+  if (p->linelen > 0) {
+    p->line[p->linelen] = '\0';
+    sfpParseLine(p, p->line);
+    p->linelen = 0;
+  }
+}
+
+/*
+ * Format a record as a line of MergedLog.txt (same as ProcessData.sh),
+ * for a read-out at time "when". Returns the length.
+ */
+static int formatSfpRecord(const SfpRecord *r, time_t when, char *out, int outlen) {
+  char daytime[40], thistime[40];
+  struct tm tm;
+  localtime_r(&when, &tm);
+  strftime(daytime, sizeof(daytime), "%b %d %H:%M:00", &tm);     // Human-friendly date
+  strftime(thistime, sizeof(thistime), "%Y.%m.%d %H:%M.00", &tm); // Actual date and time
+
+  return snprintf(out, outlen, "%s\t%s:%d\t%s\t%s\t%s\t%s\t%s\t%s\n", daytime, r->hostname, r->port, thistime,
+                  r->text[0], r->text[1], r->text[2], r->text[3], r->text[4]);
+}
+
+#endif
@@ -0,0 +1,613 @@
+/*
+ * SwitchPoller
+ *
+ * Use:
+ *
+ *  - SwitchPoller [options] <switch address> [<switch address> ...]
+ *
+ * Reads the SFP diagnostics of all the switches at the same time, instead
+ * of one after the other with switchread.sh and ProcessData.sh. Each
+ * switch gets its own CLI session (ssh through a pseudo-terminal, like
+ * the Expect script), driven from a single poll() loop.
+ *
+ * For every switch and cycle:
+ *
+ *  - log in if there is no open session (or it was dropped),
+ *  - send "port sfp" and wait for the prompt,
+ *  - parse the answer as it arrives, with SfpParser.h (the same rules as
+ *    ProcessData.sh, without temp.txt or SwitchLog.txt). If it has
+ *    negative values (the intermittent "Error"), save the raw answer in a
+ *    file named after the date and time, as FibreMonitorSwitches.sh did,
+ *    and ask again after a back-off (0.5 s, 1 s, 2 s... up to 5 s), up to
+ *    the maximum number of retries,
+ *  - append the good lines to the log file (and to the binary store of
+ *    FibreStore.h, with -s),
+ *  - with -m, give them to the anomaly detector of FibreAnomaly.h, which
+ *    writes its alerts at the end of the cycle (STALE ones also when no
+ *    switch answered),
+ *  - give up on the switch when its deadline for the cycle is over.
+ *
+ * A line per switch with the latency, retries and logins is printed at
+ * the end of each cycle (logins=0 means the session was reused).
+ *
+ * With -i, the program stays running and polls every "interval" seconds,
+ * keeping the sessions open between cycles, and runs the -x command
+ * (e.g. the plotting) after each cycle.
+ *
+ * Options:
+ *
+ *  -c command   Command to open a session, %s is replaced by the address.
+ *               Default: "ssh -o StrictHostKeyChecking=no username@%s".
+ *  -P file      File with the password to send at the password prompt
+ *               (first line), readable only by its owner. The
+ *               SWITCH_PASSWORD environment variable is used instead if
+ *               it is set. The password is never taken from the command
+ *               line, where ps would show it. Default: SwitchPassword.txt.
+ *  -o file      Log file to append to. Default: MergedLog.txt.
+ *  -s directory Binary store to append to as well. Default: none.
+ *  -m file      Fibre map, to look for anomalies. Default: none.
+ *  -A file      Alert log of the anomaly detector, its state is kept in
+ *               <file>.state between runs. Default: FibreAlerts.log.
+ *  -t seconds   Deadline for each switch in each cycle. Default: 60.
+ *  -r retries   Maximum number of retries after an Error. Default: 20.
+ *  -i seconds   Poll every "seconds" seconds, forever. Default: one cycle.
+ *  -x command   Command to run after each cycle.
+ *
+ * Try it without switches with FakeSwitchCLI.
+ *
+ * Compile with:
+ *
+ *  g++ -O2 -o SwitchPoller SwitchPoller.cxx -lutil
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pty.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "FibreLogReader.h"
+#include "FibreStore.h"
+#include "FibreMap.h"
+#include "FibreAnomaly.h"
+#include "SfpParser.h"
+
+#define MAX_SWITCHES 64
+#define MAX_BUFFER 100000     // Same as match_max in switchread.sh
+#define PROMPT "/>"
+#define BACKOFF_FIRST_MS 500
+#define BACKOFF_MAX_MS 5000
+
+enum {
+  SESSION_DOWN,       // No session open
+  SESSION_LOGIN,      // Waiting for the password prompt or the first prompt
+  SESSION_IDLE,       // At the prompt
+  SESSION_BUSY        // Waiting for the answer to "port sfp"
+};
+
+typedef struct {
+  const char *address;
+  pid_t pid;
+  int fd;
+  int state;
+  int password_sent;
+  char buffer[MAX_BUFFER + 1];
+  int len;
+  char prompt[200];           // Last prompt line seen, has the hostname
+  SfpParser parser;           // Answer to "port sfp"
+
+  // Current cycle
+  int done;
+  int ok;
+  int retries;
+  int logins;
+  int failures;               // Consecutive failed logins, for the back-off
+  long cycle_start;
+  long deadline;
+  long next_action;           // Don't do anything before this time
+  long latency;
+} Session;
+
+static volatile sig_atomic_t stop = 0;
+
+static void onSignal(int sig) {
+  stop = 1;
+}
+
+/*
+ * Milliseconds from an arbitrary point, not affected by clock changes.
+ */
+static long nowMs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec*1000L + ts.tv_nsec/1000000L;
+}
+
+static long backoffMs(int attempt) {
+  long ms = BACKOFF_FIRST_MS;
+  for (int i = 1; (i < attempt) && (ms < BACKOFF_MAX_MS); i++) {
+    ms *= 2;
+  }
+
+  return ms < BACKOFF_MAX_MS ? ms : BACKOFF_MAX_MS;
+}
+
+/*
+ * Start the session command in a pseudo-terminal.
+ */
+static int openSession(Session *s, const char *command) {
+  char cmd[1000];
+  snprintf(cmd, sizeof(cmd), command, s->address);
+
+  pid_t pid = forkpty(&s->fd, NULL, NULL, NULL);
+  if (pid < 0) {
+    return -1;
+  }
+  if (pid == 0) {
+    execl("/bin/sh", "sh", "-c", cmd, (char*)NULL);
+    _exit(127);
+  }
+  fcntl(s->fd, F_SETFL, fcntl(s->fd, F_GETFL) | O_NONBLOCK);
+  s->pid = pid;
+  s->state = SESSION_LOGIN;
+  s->password_sent = 0;
+  s->len = 0;
+
+  return 0;
+}
+
+static void closeSession(Session *s) {
+  if (s->state == SESSION_DOWN) {
+    return;
+  }
+  close(s->fd);
+  kill(s->pid, SIGTERM);
+  waitpid(s->pid, NULL, 0);
+  s->state = SESSION_DOWN;
+  s->fd = -1;
+}
+
+static void logoutSession(Session *s) {
+  if (s->state == SESSION_IDLE) {
+    write(s->fd, "logout\r", 7);
+    usleep(100000);
+  }
+  closeSession(s);
+}
+
+static void sendLine(Session *s, const char *line) {
+  char buf[200];
+  int n = snprintf(buf, sizeof(buf), "%s\r", line);
+  if (write(s->fd, buf, n) != n) {
+    closeSession(s);
+  }
+}
+
+/*
+ * Remember the last line with a prompt in the buffer.
+ * Returns 1 if there is a prompt (the answer is complete).
+ */
+static int takePrompt(Session *s) {
+  char *p = NULL;
+  for (char *q = strstr(s->buffer, PROMPT); q != NULL; q = strstr(q + 1, PROMPT)) {
+    p = q;
+  }
+  if (p == NULL) {
+    return 0;
+  }
+  char *start = p;
+  while ((start > s->buffer) && (start[-1] != '\n') && (start[-1] != '\r')) {
+    start--;
+  }
+  int n = p + strlen(PROMPT) - start;
+  if (n >= (int)sizeof(s->prompt)) {
+    n = sizeof(s->prompt) - 1;
+  }
+  memcpy(s->prompt, start, n);
+  s->prompt[n] = '\0';
+
+  return 1;
+}
+
+/*
+ * Timestamp of the log lines written at "when" (see FibreLogReader.h).
+ */
+static int logTime(time_t when) {
+  struct tm tm;
+  localtime_r(&when, &tm);
+
+  return fibreLogDaysFromCivil(tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday)*86400 + tm.tm_hour*3600 + tm.tm_min*60;
+}
+
+/*
+ * Append the records of an answer to the binary store in dir.
+ */
+static void appendToStore(const char *dir, const SfpParser *parser, int time) {
+  for (int i = 0; i < parser->nrecords; i++) {
+    const SfpRecord *r = &parser->records[i];
+    FibreStoreWriter w;
+    if (openFibreStoreWriter(dir, r->hostname, r->port, &w) < 0) {
+      fprintf(stderr, "Cannot open %s:%d in %s\n", r->hostname, r->port, dir);
+      continue;
+    }
+    FibreStoreRecord rec;
+    rec.time = time;
+    rec.temp = r->temp;
+    rec.voltage = r->voltage;
+    rec.current = r->current;
+    rec.Ptx = r->Ptx;
+    rec.Prx = r->Prx;
+    fibreStoreAppend(&w, &rec);
+    closeFibreStoreWriter(&w);
+  }
+}
+
+/*
+ * Deal with a complete answer. Good lines are appended to out. Returns 1
+ * if all good, 0 if there were negative values or no ports at all.
+ */
+static int processAnswer(Session *s, FILE *out, const char *store, FibreAnomaly *detector) {
+  SfpParser *p = &s->parser;
+  snprintf(s->prompt, sizeof(s->prompt), "%s", p->line);   // The prompt at the end
+  finishSfpAnswer(p);
+
+  time_t now = time(NULL);
+  int ok = (p->nerrors == 0) && (p->nrecords > 0);
+  if (ok) {
+    char line[400];
+    for (int i = 0; i < p->nrecords; i++) {
+      formatSfpRecord(&p->records[i], now, line, sizeof(line));
+      fputs(line, out);
+    }
+    fflush(out);
+    if (store != NULL) {
+      appendToStore(store, p, logTime(now));
+    }
+    for (int i = 0; (detector != NULL) && (i < p->nrecords); i++) {
+      const SfpRecord *r = &p->records[i];
+      fibreAnomalySample(detector, r->hostname, r->port, logTime(now), r->Ptx, r->Prx);
+    }
+  }
+  else {
+    // Keep the raw answer (it starts with the prompt), like FibreMonitorSwitches.sh
+    char dumpname[100];
+    strftime(dumpname, sizeof(dumpname), "%Y%m%d_%H%M%S", localtime(&now));
+    snprintf(dumpname + strlen(dumpname), sizeof(dumpname) - strlen(dumpname), "_%s", s->address);
+    FILE *dump = fopen(dumpname, "w");
+    if (dump != NULL) {
+      fwrite(p->raw, 1, p->rawlen, dump);
+      fclose(dump);
+    }
+  }
+
+  return ok;
+}
+
+/*
+ * Poll all the switches once. Sessions are left open at the end.
+ */
+static void pollCycle(Session *sessions, int n, const char *command, const char *password, FILE *out,
+                      const char *store, FibreAnomaly *detector, int deadline_s, int max_retries) {
+  long start = nowMs();
+  for (int i = 0; i < n; i++) {
+    Session *s = &sessions[i];
+    s->done = 0;
+    s->ok = 0;
+    s->retries = 0;
+    s->logins = 0;
+    s->cycle_start = start;
+    s->deadline = start + deadline_s*1000L;
+    s->next_action = start;
+    s->latency = 0;
+  }
+
+  int pending = n;
+  while ((pending > 0) && !stop) {
+    long now = nowMs();
+    long wait = 1000;
+    struct pollfd fds[MAX_SWITCHES];
+    int fd_session[MAX_SWITCHES];
+    int nfds = 0;
+
+    for (int i = 0; i < n; i++) {
+      Session *s = &sessions[i];
+      if (s->done) continue;
+      if (now >= s->deadline) {
+        // Out of time: the session is in an unknown state, drop it
+        if (s->state != SESSION_IDLE) {
+          closeSession(s);
+        }
+        s->done = 1;
+        pending--;
+        continue;
+      }
+      if (now >= s->next_action) {
+        if (s->state == SESSION_DOWN) {
+          if (openSession(s, command) < 0) {
+            s->failures++;
+            s->next_action = now + backoffMs(s->failures);
+          }
+          else {
+            s->logins++;
+          }
+        }
+        else if (s->state == SESSION_IDLE) {
+          // Drop anything that came while idle
+          char junk[1000];
+          while (read(s->fd, junk, sizeof(junk)) > 0);
+          startSfpAnswer(&s->parser, s->prompt);
+          sendLine(s, "port sfp");
+          if (s->state == SESSION_IDLE) {
+            s->state = SESSION_BUSY;
+          }
+        }
+      }
+      if ((s->state == SESSION_LOGIN) || (s->state == SESSION_BUSY)) {
+        fds[nfds].fd = s->fd;
+        fds[nfds].events = POLLIN;
+        fd_session[nfds] = i;
+        nfds++;
+      }
+      long until = ((s->state == SESSION_DOWN) || (s->state == SESSION_IDLE)) ? s->next_action : s->deadline;
+      if (until - now < wait) {
+        wait = until - now;
+      }
+    }
+    if (pending == 0) {
+      break;
+    }
+    if (wait < 0) {
+      wait = 0;
+    }
+
+    if (poll(fds, nfds, wait) < 0) {
+      if (errno == EINTR) continue;
+      break;
+    }
+
+    now = nowMs();
+    for (int f = 0; f < nfds; f++) {
+      Session *s = &sessions[fd_session[f]];
+      if (fds[f].revents == 0) continue;
+
+      if (s->state == SESSION_BUSY) {
+        // The answer goes straight to the parser
+        char chunk[4096];
+        int got = read(s->fd, chunk, sizeof(chunk));
+        if (got <= 0) {
+          if ((got < 0) && (errno == EAGAIN)) continue;
+          closeSession(s);
+          s->failures++;
+          s->next_action = now + backoffMs(s->failures);
+          continue;
+        }
+        feedSfpParser(&s->parser, chunk, got);
+        if (s->parser.prompt_seen) {
+          s->state = SESSION_IDLE;
+          if (processAnswer(s, out, store, detector)) {
+            s->ok = 1;
+            s->done = 1;
+            s->latency = now - s->cycle_start;
+            pending--;
+          }
+          else if (s->retries >= max_retries) {
+            s->done = 1;
+            pending--;
+          }
+          else {
+            s->retries++;
+            s->next_action = now + backoffMs(s->retries);
+          }
+        }
+        else if (s->parser.rawlen == SFP_MAXRAW) {   // Garbage: start over
+          closeSession(s);
+          s->next_action = now;
+        }
+        continue;
+      }
+
+      int got = read(s->fd, s->buffer + s->len, MAX_BUFFER - s->len);
+      if (got <= 0) {
+        if ((got < 0) && (errno == EAGAIN)) continue;
+        // Session closed by the other side: log in again later
+        closeSession(s);
+        s->failures++;
+        s->next_action = now + backoffMs(s->failures);
+        continue;
+      }
+      s->len += got;
+      s->buffer[s->len] = '\0';
+      if (s->len == MAX_BUFFER) {   // Garbage: start over
+        closeSession(s);
+        s->next_action = now;
+        continue;
+      }
+
+      if (s->state == SESSION_LOGIN) {
+        if (!s->password_sent && (strstr(s->buffer, "assword:") != NULL)) {
+          sendLine(s, password);
+          s->password_sent = 1;
+          s->len = 0;
+          s->buffer[0] = '\0';
+        }
+        else if (takePrompt(s)) {
+          s->state = SESSION_IDLE;
+          s->failures = 0;
+          s->next_action = now;
+        }
+      }
+    }
+  }
+
+  // Report
+  char date[100];
+  time_t t = time(NULL);
+  strftime(date, sizeof(date), "%Y.%m.%d %H:%M:%S", localtime(&t));
+  for (int i = 0; i < n; i++) {
+    Session *s = &sessions[i];
+    printf("%s\t%s\t%s\tlatency_ms=%ld\tretries=%d\tlogins=%d\n", date, s->address,
+           s->ok ? "ok" : (nowMs() >= s->deadline ? "timeout" : "failed"),
+           s->ok ? s->latency : nowMs() - s->cycle_start, s->retries, s->logins);
+  }
+  fflush(stdout);
+}
+
+/*
+ * The password from SWITCH_PASSWORD, or else from the first line of the
+ * file. Returns 0 if there is none.
+ */
+static int readPassword(const char *filename, char *password, int len) {
+  const char *env = getenv("SWITCH_PASSWORD");
+  if (env != NULL) {
+    snprintf(password, len, "%s", env);
+    return 1;
+  }
+
+  FILE *f = fopen(filename, "r");
+  if (f == NULL) {
+    fprintf(stderr, "No password: set SWITCH_PASSWORD or write it in %s\n", filename);
+    return 0;
+  }
+  struct stat st;
+  if ((fstat(fileno(f), &st) == 0) && (st.st_mode & 077)) {
+    fprintf(stderr, "Warning: %s can be read by other users (chmod 600 %s)\n", filename, filename);
+  }
+  int ok = (fgets(password, len, f) != NULL);
+  fclose(f);
+  if (ok) {
+    password[strcspn(password, "\r\n")] = '\0';
+  }
+  else {
+    fprintf(stderr, "No password in %s\n", filename);
+  }
+
+  return ok;
+}
+
+int main(int argc, char **argv) {
+  const char *command = "ssh -o StrictHostKeyChecking=no username@%s";
+  const char *password_file = "SwitchPassword.txt";
+  const char *outname = "MergedLog.txt";
+  const char *store = NULL;
+  const char *mapname = NULL;
+  const char *alertname = "FibreAlerts.log";
+  const char *after = NULL;
+  int deadline_s = 60;
+  int max_retries = 20;
+  int interval = 0;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "c:P:o:s:m:A:t:r:i:x:")) != -1) {
+    switch (opt) {
+      case 'c': command = optarg; break;
+      case 'P': password_file = optarg; break;
+      case 'o': outname = optarg; break;
+      case 's': store = optarg; break;
+      case 'm': mapname = optarg; break;
+      case 'A': alertname = optarg; break;
+      case 't': deadline_s = atoi(optarg); break;
+      case 'r': max_retries = atoi(optarg); break;
+      case 'i': interval = atoi(optarg); break;
+      case 'x': after = optarg; break;
+      default:
+        fprintf(stderr, "Use: %s [-c command] [-P password file] [-o log] [-s store] [-m fibremap] [-A alerts] [-t deadline] [-r retries] "
+                        "[-i interval] [-x command] <switch> [<switch> ...]\n", argv[0]);
+        return 1;
+    }
+  }
+  int n = argc - optind;
+  if ((n <= 0) || (n > MAX_SWITCHES)) {
+    fprintf(stderr, "Give between 1 and %d switch addresses\n", MAX_SWITCHES);
+    return 1;
+  }
+
+  char password[200];
+  if (!readPassword(password_file, password, sizeof(password))) {
+    return 1;
+  }
+
+  FILE *out = fopen(outname, "a");
+  if (out == NULL) {
+    fprintf(stderr, "Cannot open %s\n", outname);
+    return 1;
+  }
+
+  // Anomaly detector, carrying on from the last run
+  FibreMapEntry *map = NULL;
+  FibreAnomaly detector;
+  FibreAnomaly *det = NULL;
+  FILE *alerts = NULL;
+  char statename[1000];
+  snprintf(statename, sizeof(statename), "%s.state", alertname);
+  if (mapname != NULL) {
+    int nfibres = readFibreMap(mapname, &map);
+    alerts = fopen(alertname, "a");
+    if ((nfibres <= 0) || (alerts == NULL)) {
+      fprintf(stderr, "Cannot read %s or write %s\n", mapname, alertname);
+      return 1;
+    }
+    FibreAnomalyConfig config;
+    defaultFibreAnomalyConfig(&config);
+    if (interval > 0) {
+      config.interval = interval;
+    }
+    initFibreAnomaly(&detector, &config, map, nfibres, alerts);
+    loadFibreAnomaly(statename, &detector);
+    det = &detector;
+  }
+
+  Session *sessions = (Session*)calloc(n, sizeof(Session));
+  for (int i = 0; i < n; i++) {
+    sessions[i].address = argv[optind + i];
+    sessions[i].state = SESSION_DOWN;
+    sessions[i].fd = -1;
+    initSfpParser(&sessions[i].parser);
+  }
+
+  signal(SIGINT, onSignal);
+  signal(SIGTERM, onSignal);
+  signal(SIGPIPE, SIG_IGN);
+
+  while (!stop) {
+    long start = nowMs();
+    pollCycle(sessions, n, command, password, out, store, det, deadline_s, max_retries);
+    if (det != NULL) {
+      fibreAnomalyFlush(det, logTime(time(NULL)));   // Also if no switch answered
+      if (!saveFibreAnomaly(statename, det)) {
+        fprintf(stderr, "Cannot save %s\n", statename);
+      }
+    }
+    if (after != NULL) {
+      system(after);
+    }
+    if (interval <= 0) {
+      break;
+    }
+    // Wait for the next cycle
+    while (!stop && (nowMs() - start < interval*1000L)) {
+      usleep(200000);
+    }
+  }
+
+  for (int i = 0; i < n; i++) {
+    logoutSession(&sessions[i]);
+    freeSfpParser(&sessions[i].parser);
+  }
+  fclose(out);
+  free(sessions);
+  if (det != NULL) {
+    fclose(alerts);
+    freeFibreAnomaly(det);
+    free(map);
+  }
+
+  return 0;
+}